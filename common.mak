@@ -1,7 +1,7 @@
 DEBUGFLAGS ?= -O3
 
 CFLAGS = -std=c99 -m32 -ffreestanding -nostdlib -nodefaultlibs -Wall -Werror $(DEBUGFLAGS)
-CCFLAGS = -std=c++0x -fno-exceptions -fno-rtti -m32 -ffreestanding -nostdlib -nodefaultlibs -Wall -Werror $(DEBUGFLAGS)
+CCFLAGS = -std=c++0x -fno-exceptions -fno-rtti -m32 -mno-mmx -mno-sse -ffreestanding -nostdlib -nodefaultlibs -Wall -Werror $(DEBUGFLAGS)
 
 CFILES = $(wildcard *.c)
 CCFILES = $(wildcard *.cc)
@@ -16,6 +16,20 @@ public:
         );
         return out;
     }
+    inline void setBits(uint32_t m) {
+        asm volatile ("lock orl %[m],%[v]"
+            : [v] "=m"(v)
+            : [m] "r"(m), "m"(v)
+            : "memory", "cc"
+        );
+    }
+    inline void clearBits(uint32_t m) {
+        asm volatile ("lock andl %[m],%[v]"
+            : [v] "=m"(v)
+            : [m] "r"(~m), "m"(v)
+            : "memory", "cc"
+        );
+    }
     inline uint32_t get() {
         return v;
     }
@@ -1,13 +1,24 @@
 #include "child.h"
 #include "machine.h"
 #include "err.h"
+#include "fpu.h"
 
-Child::Child(Process *parent) : Process("child",parent->resources->forkMe()) {
-    parent->addressSpace.fork(&addressSpace);
-    this->parent = parent;
+Child::Child(Process *parent, bool vfork) :
+    Process("child",parent->resources->forkMe(),
+        vfork ? parent->addressSpace : nullptr),
+    vforked(vfork)
+{
+    parent->adopt(this);
+    signalMask = parent->signalMask;
+    Fpu::fork(parent,this);
 }
 
 long Child::run() {
+    if (vforked) {
+        // it runs on its parent's stack, so it needs the parent's
+        // callee saved registers too
+        sys_sigret((uint32_t) &registers);
+    }
     switchToUser(pc,esp,0);
     return ERR_NOT_POSSIBLE;
 }
@@ -8,7 +8,13 @@ public:
     uint32_t eax;
     uint32_t esp;
     uint32_t pc;
-    Child(Process *parent);
+
+    // a vfork child starts with all of its parent's registers
+    bool vforked;
+    regs registers;
+
+    // vfork => share the parent's address space instead of copying it
+    Child(Process *parent, bool vfork = false);
     virtual long run();
 };
 
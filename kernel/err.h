@@ -7,5 +7,6 @@
 #define ERR_NO_ID (-1003)
 #define ERR_NOT_POSSIBLE (-1004)
 #define ERR_PAGE_FAULT (-1005)
+#define ERR_BROKEN_PIPE (-1006)
 
 #endif
@@ -0,0 +1,155 @@
+#include "fpu.h"
+#include "process.h"
+#include "machine.h"
+#include "idt.h"
+#include "debug.h"
+
+Process* Fpu::owner = nullptr;
+
+#define CR0_MP (1 << 1)
+#define CR0_EM (1 << 2)
+#define CR0_TS (1 << 3)
+#define CR0_NE (1 << 5)
+#define CR4_OSFXSR (1 << 9)
+#define CR4_OSXMMEXCPT (1 << 10)
+
+#define CPUID_FXSR (1 << 24)
+#define CPUID_SSE (1 << 25)
+
+static bool present = false;
+static bool tsSet = false;
+/* the MXCSR bits FXRSTOR accepts */
+static uint32_t mxcsrMask = 0;
+
+/* the state every process starts with */
+static char initialRaw[Fpu::AREA_SIZE + 16];
+static char* initial;
+
+static inline char* align(char* p) {
+    return (char*) ((((uint32_t) p) + 15) & ~15);
+}
+
+/* the process's save area */
+static inline char* area(Process* p) {
+    return align(p->fpuState);
+}
+
+static inline void setTS(bool on) {
+    if (on != tsSet) {
+        if (on) {
+            setcr0(getcr0() | CR0_TS);
+        } else {
+            clts();
+        }
+        tsSet = on;
+    }
+}
+
+void Fpu::init() {
+    uint32_t features = cpuidEdx(1);
+    if ((features & (CPUID_FXSR | CPUID_SSE)) != (CPUID_FXSR | CPUID_SSE)) {
+        Debug::printf("no SSE, user programs can't use the FPU\n");
+        return;
+    }
+    present = true;
+
+    setcr0((getcr0() & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+    setcr4(getcr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+
+    /* capture a clean state: fninit leaves MXCSR at its reset value */
+    fninit();
+    initial = align(initialRaw);
+    fxsave(initial);
+    /* MXCSR_MASK is in the FXSAVE area, 0 means the default */
+    mxcsrMask = *(uint32_t*) (initial + 28);
+    if (mxcsrMask == 0) mxcsrMask = 0xffbf;
+
+    setTS(true);
+    IDT::addTrapHandler(7,(uint32_t)fpuTrapHandler,0);
+}
+
+void Fpu::switchTo(Process* next) {
+    if (!present) return;
+    setTS(next != owner);
+}
+
+void Fpu::trap() {
+    Process* me = Process::current;
+    if (!present || (me == nullptr)) {
+        Debug::panic("unexpected #NM");
+    }
+
+    Process::disable();
+    setTS(false);
+    if (owner != me) {
+        if (owner != nullptr) {
+            fxsave(area(owner));
+        }
+        if (me->fpuState == nullptr) {
+            me->fpuState = new char[AREA_SIZE + 16];
+            fxrstor(initial);
+        } else {
+            fxrstor(area(me));
+        }
+        owner = me;
+    }
+    Process::enable();
+}
+
+void Fpu::fork(Process* parent, Process* child) {
+    Process::disable();
+    if (parent->fpuState != nullptr) {
+        if (owner == parent) {
+            /* the registers are newer than the save area */
+            setTS(false);
+            fxsave(area(parent));
+            setTS(Process::current != owner);
+        }
+        child->fpuState = new char[AREA_SIZE + 16];
+        memcpy(area(child),area(parent),AREA_SIZE);
+    }
+    Process::enable();
+}
+
+bool Fpu::save(Process* p, char* to) {
+    if (!present || (p->fpuState == nullptr)) return false;
+    if (owner == p) {
+        setTS(false);
+        fxsave(to);
+        setTS(Process::current != owner);
+    } else {
+        memcpy(to,area(p),AREA_SIZE);
+    }
+    return true;
+}
+
+void Fpu::restore(Process* p, const char* from) {
+    if (!present) return;
+    if (p->fpuState == nullptr) {
+        p->fpuState = new char[AREA_SIZE + 16];
+    }
+    memcpy(area(p),from,AREA_SIZE);
+    *(uint32_t*) (area(p) + 24) &= mxcsrMask;
+    if (owner == p) {
+        /* the registers are stale now, the next use loads the area */
+        owner = nullptr;
+        setTS(true);
+    }
+}
+
+void Fpu::release(Process* p) {
+    Process::disable();
+    if (owner == p) {
+        owner = nullptr;
+        setTS(true);
+    }
+    if (p->fpuState != nullptr) {
+        delete[] p->fpuState;
+        p->fpuState = nullptr;
+    }
+    Process::enable();
+}
+
+extern "C" void fpu_trap() {
+    Fpu::trap();
+}
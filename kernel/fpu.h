@@ -0,0 +1,47 @@
+#ifndef _FPU_H_
+#define _FPU_H_
+
+#include "stdint.h"
+
+class Process;
+
+/*
+ * Lazy x87/SSE context switching.
+ *
+ * Only one process owns the FPU registers at a time. Switching to any
+ * other process sets CR0.TS, so its first FPU instruction traps (#NM)
+ * and only then do we save the owner's registers and load its own.
+ * Processes that never touch the FPU never pay for it.
+ */
+class Fpu {
+public:
+    /* bytes in an FXSAVE area, it must be 16 byte aligned */
+    static constexpr uint32_t AREA_SIZE = 512;
+
+    /* the process whose state is in the registers, nullptr => none */
+    static Process* owner;
+
+    static void init();
+
+    /* called on every context switch */
+    static void switchTo(Process* next);
+
+    /* #NM, the current process wants the FPU */
+    static void trap();
+
+    /* the child starts with a copy of the parent's state */
+    static void fork(Process* parent, Process* child);
+
+    /* copy p's state to the 16 byte aligned area at to, for a signal
+       frame. false if p never used the FPU. precondition: disabled */
+    static bool save(Process* p, char* to);
+
+    /* replace p's state with the area at from (user memory, MXCSR bits
+       the CPU would fault on are dropped). precondition: disabled */
+    static void restore(Process* p, const char* from);
+
+    /* forget the state, on exec and when the process goes away */
+    static void release(Process* p);
+};
+
+#endif
@@ -3,6 +3,7 @@
 #include "process.h"
 #include "stdint.h"
 #include "err.h"
+#include "vmm.h"
 
 /**************/
 /* FileSystem */
@@ -22,8 +23,15 @@ static uint32_t min(uint32_t a, uint32_t b) {
     return (a < b) ? a : b;
 }
 
-/* An open Fat439 file, one per file, per system */
-class OpenFile : public Resource {
+/* An open Fat439 file, one per file, per system.
+
+   It also holds the file's page cache: a frame per page of the file,
+   read from the disk the first time someone asks for it. Reads copy
+   from the cache and mmap maps its frames, so every process sees the
+   same copy. The file system is read only, so the cache never has to
+   be written back; Fat439 keeps every file it has opened, cache and
+   all, until shutdown */
+class OpenFile : public Resource, public Pager {
 public:
     uint32_t start;
     struct {
@@ -32,21 +40,31 @@ public:
     } metaData;
     Fat439 *fs;
 
+    /* frames[n] holds page n, 0 => not read yet */
+    uint32_t nPages;
+    uint32_t *frames;
+    Mutex cacheMutex;
+
     OpenFile(Fat439 *fs, uint32_t start) : Resource(ResourceType::OTHER) {
         this->start = start;
         this->fs = fs;
         fs->dev->readFully(start * 512, &metaData, sizeof(metaData));
+        nPages = (metaData.length + PhysMem::FRAME_SIZE - 1) / PhysMem::FRAME_SIZE;
+        frames = new uint32_t[nPages]();
     }
 
     virtual ~OpenFile() {
+        for (uint32_t i=0; i<nPages; i++) {
+            if (frames[i]) PhysMem::free(frames[i]);
+        }
+        delete[] frames;
     }
 
     uint32_t getLength() { return  metaData.length; }
     uint32_t getType() { return metaData.type; }
-    int32_t read(uint32_t offset, void* buf, uint32_t length) {
-        if (offset > metaData.length) {
-            return ERR_TOO_LONG;
-        }
+
+    /* read from the disk, the file's data starts after the metadata */
+    int32_t readBlocks(uint32_t offset, void* buf, uint32_t length) {
         uint32_t len = min(length,metaData.length - offset);
 
         uint32_t actualOffset = offset + 8;
@@ -64,6 +82,46 @@ public:
         return count;
     }
 
+    virtual uint32_t page(uint32_t n) {
+        if (n >= nPages) return 0;
+        uint32_t frame = frames[n];
+        if (frame != 0) return frame;
+
+        cacheMutex.lock();
+        frame = frames[n];
+        if (frame == 0) {
+            frame = PhysMem::alloc();
+            uint32_t offset = n * PhysMem::FRAME_SIZE;
+            uint32_t togo = min(PhysMem::FRAME_SIZE,metaData.length - offset);
+            char* p = (char*) frame;
+            while (togo > 0) {
+                int32_t cnt = readBlocks(offset,p,togo);
+                if (cnt <= 0) break;
+                p += cnt;
+                offset += cnt;
+                togo -= cnt;
+            }
+            frames[n] = frame;
+        }
+        cacheMutex.unlock();
+        return frame;
+    }
+
+    /* served from the page cache */
+    int32_t read(uint32_t offset, void* buf, uint32_t length) {
+        if (offset > metaData.length) {
+            return ERR_TOO_LONG;
+        }
+        uint32_t inPage = offset % PhysMem::FRAME_SIZE;
+        uint32_t len = min(length,metaData.length - offset);
+        len = min(len,PhysMem::FRAME_SIZE - inPage);
+        if (len == 0) return 0;
+
+        uint32_t frame = page(offset / PhysMem::FRAME_SIZE);
+        memcpy(buf,(void*) (frame + inPage),len);
+        return len;
+    }
+
     int32_t readFully(uint32_t offset, void* buf, uint32_t length) {
         char* p = (char*) buf;
         uint32_t togo = length;
@@ -101,6 +159,7 @@ public:
 
     virtual uint32_t getLength() { return openFile->getLength(); }
     virtual uint32_t getType() { return openFile->getType(); }
+    virtual Pager* pager() { return openFile; }
     virtual int32_t read(void* buf, uint32_t length) {
         long cnt = openFile->read(offset,buf,length);
         if (cnt > 0) offset += cnt;
@@ -181,6 +240,8 @@ OpenFile* Fat439::openFile(uint32_t start) {
     if (p == nullptr) {
         p = new OpenFile(this,start);
         openFiles[start] = p;
+        /* mappings use its cache after the last close */
+        Resource::ref(p);
     }
     Resource::ref(p);
     openFilesMutex.unlock();
@@ -4,6 +4,8 @@
 #include "block.h"
 #include "resource.h"
 #include "semaphore.h"
+#include "poll.h"
+#include "vma.h"
 
 /****************/
 /* File systems */
@@ -29,6 +31,14 @@ public:
         this->offset = offset;
     }
 
+    /* files never block */
+    virtual long poll(long events) {
+        return events & POLLIN;
+    }
+
+    /* the cached pages of the file, for mmap. nullptr => can't be mapped */
+    virtual Pager* pager() { return nullptr; }
+
     /* We can read a few bytes, returned value:
          < 0 => error
          0 => end of file
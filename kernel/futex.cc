@@ -0,0 +1,164 @@
+#include "futex.h"
+#include "process.h"
+#include "queue.h"
+#include "err.h"
+
+/* A queue of processes sleeping on futexes that hash to one bucket */
+class FutexQueue : public Queue<Process*> {
+    class Node {
+    public:
+        Node* next;
+        Process* value;
+        uint32_t key;
+    };
+
+    Node *first;
+    Node *last;
+    unsigned long nodes;
+public:
+    /* the key for the next addTail, yield doesn't know about keys */
+    uint32_t nextKey;
+
+    FutexQueue() : first(0), last(0), nodes(0), nextKey(0) {}
+
+    void addTail(Process* p) {
+        Node *n = new Node();
+        n->value = p;
+        n->key = nextKey;
+        n->next = 0;
+        if (last != 0) {
+            last->next = n;
+        } else {
+            first = n;
+        }
+        last = n;
+        nodes ++;
+    }
+    bool isEmpty() {
+        return first == 0;
+    }
+    Process* removeHead() {
+        Node *p = first;
+        first = p->next;
+        if (first == 0) last = 0;
+        Process* v = p->value;
+        delete p;
+        nodes --;
+        return v;
+    }
+    unsigned long size() {
+        return nodes;
+    }
+
+    /* remove the oldest waiter for key, nullptr if there is none */
+    Process* remove(uint32_t key) {
+        Node *prev = 0;
+        for (Node *p = first; p != 0; prev = p, p = p->next) {
+            if (p->key == key) {
+                if (prev) prev->next = p->next; else first = p->next;
+                if (last == p) last = prev;
+                Process* v = p->value;
+                delete p;
+                nodes --;
+                return v;
+            }
+        }
+        return nullptr;
+    }
+
+    /* a waiter that was killed */
+    bool removeValue(Process* v) {
+        Node *prev = 0;
+        for (Node *p = first; p != 0; prev = p, p = p->next) {
+            if (p->value == v) {
+                if (prev) prev->next = p->next; else first = p->next;
+                if (last == p) last = prev;
+                delete p;
+                nodes --;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /* is anyone waiting on a word in the frame? */
+    bool waitsIn(uint32_t frame) {
+        for (Node *p = first; p != 0; p = p->next) {
+            if ((p->key & 0xfffff000) == frame) return true;
+        }
+        return false;
+    }
+};
+
+static FutexQueue *buckets;
+
+void Futex::init() {
+    buckets = new FutexQueue[BUCKETS];
+}
+
+static inline FutexQueue* bucket(uint32_t key) {
+    /* words are aligned, mix in the frame number */
+    return &buckets[((key >> 2) ^ (key >> 12)) % Futex::BUCKETS];
+}
+
+/* the physical address of a user word, 0 if it can't be a futex */
+static uint32_t keyOf(uint32_t va) {
+    if ((va & 3) != 0) return 0;
+    if (va < KernelMemory::USER_BASE) return 0;
+    return Process::current->addressSpace->physical(va);
+}
+
+long Futex::wait(uint32_t va, uint32_t val) {
+    if (((va & 3) != 0) || (va < KernelMemory::USER_BASE)) return ERR_NOT_POSSIBLE;
+
+    /* touching it maps it if needed */
+    volatile uint32_t *p = (volatile uint32_t*) va;
+    if (*p != val) return ERR_NOT_POSSIBLE;
+    /* a copy on write page (the zero page) gets its own frame now, so
+       the waker's write doesn't move the word out from under the key */
+    if (Process::current->addressSpace->entry(va) & AddressSpace::COW) {
+        ((Atomic32*) p)->setBits(0);
+    }
+
+    Process::disable();
+    uint32_t key = keyOf(va);
+    if ((key == 0) || (*p != val)) {
+        Process::enable();
+        return ERR_NOT_POSSIBLE;
+    }
+    /* interrupts stay disabled until yield has queued us */
+    FutexQueue *q = bucket(key);
+    q->nextKey = key;
+    bool woken = Process::yieldKillable(q);
+    Process::enable();
+    return woken ? 0 : ERR_NOT_POSSIBLE;
+}
+
+long Futex::wake(uint32_t va, long n) {
+    long woken = 0;
+
+    Process::disable();
+    uint32_t key = keyOf(va);
+    if (key != 0) {
+        FutexQueue *q = bucket(key);
+        while (woken < n) {
+            Process *p = q->remove(key);
+            if (p == nullptr) break;
+            p->makeReady();
+            woken ++;
+        }
+    }
+    Process::enable();
+
+    return woken;
+}
+
+bool Futex::waitedOn(uint32_t frame) {
+    bool out = false;
+    Process::disable();
+    for (uint32_t i = 0; (i < BUCKETS) && !out; i++) {
+        out = buckets[i].waitsIn(frame);
+    }
+    Process::enable();
+    return out;
+}
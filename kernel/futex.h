@@ -0,0 +1,33 @@
+#ifndef _FUTEX_H_
+#define _FUTEX_H_
+
+#include "stdint.h"
+
+/*
+ * Fast user-space locking support.
+ *
+ * User code does the uncontended work with atomic instructions on a
+ * word in its own memory and only calls in here to sleep or to wake
+ * sleepers. Waiters are keyed on the physical address of the word so
+ * the same word seen through different mappings is one futex.
+ */
+class Futex {
+public:
+    static constexpr uint32_t BUCKETS = 64;
+
+    static void init();
+
+    /* sleep if the word at va still holds val
+       returns 0 when woken, ERR_NOT_POSSIBLE if the value changed */
+    static long wait(uint32_t va, uint32_t val);
+
+    /* wake up to n processes sleeping on the word at va
+       returns how many were woken */
+    static long wake(uint32_t va, long n);
+
+    /* is anyone sleeping on a word in the frame? Swap leaves those
+       frames alone, the key would change if the page moved */
+    static bool waitedOn(uint32_t frame);
+};
+
+#endif
@@ -1,20 +1,32 @@
 #include "heap.h"
 #include "debug.h"
 #include "process.h"
+#include "vmm.h"
+#include "vmalloc.h"
 
 /* A first-fit heap */
 
 static int *array;
 static int len;
+static int maxLen;
 static bool safe = true;
 static int avail = 0;
 
 void makeTaken(int i, int ints);
 void makeAvail(int i, int ints);
+extern "C" void free(void* p);
 
-void Heap::init(void* base, size_t bytes) {
+static void mapPages(uint32_t from, uint32_t to) {
+    for (uint32_t va = from; va < to; va += PhysMem::FRAME_SIZE) {
+        KernelMemory::map(va,PhysMem::alloc());
+    }
+}
+
+void Heap::init(void* base, size_t bytes, size_t limit) {
     array = (int*) base;
     len = bytes / 4;
+    maxLen = limit / 4;
+    mapPages((uint32_t) base,((uint32_t) base) + bytes);
     makeTaken(0,2);
     makeAvail(2,len-4);
     makeTaken(len-2,2);
@@ -123,17 +135,37 @@ bool isAvail(int i) {
 bool isTaken(int i) {
     return array[i] < 0;
 }
-    
-extern "C"
-void* malloc(size_t bytes) {
-    //Debug::printf("malloc(%d)\n",bytes);
-    if (bytes == 0) return (void*) array;
 
-    int ints = ((bytes + 3) / 4) + 2;
-    if (ints < 4) ints = 4;
+/* map enough pages at the end to make room for ints more,
+   false if it's as big as it gets. Interrupts are disabled */
+static bool grow(int ints) {
+    /* at least 16 pages at a time */
+    uint32_t bytes = (ints + 4) * 4;
+    if (bytes < 16 * PhysMem::FRAME_SIZE) bytes = 16 * PhysMem::FRAME_SIZE;
+    bytes = (bytes + PhysMem::FRAME_SIZE - 1) & ~(PhysMem::FRAME_SIZE - 1);
+    int added = bytes / 4;
+    if (added > maxLen - len) return false;
+
+    uint32_t end = (uint32_t) &array[len];
+    mapPages(end,end + bytes);
+
+    /* the old end marker starts the new free block */
+    int i = len - 2;
+    int sz = added;
+    len += added;
+    makeTaken(len-2,2);
 
-    Process::disable();
+    int leftIndex = left(i);
+    if (isAvail(leftIndex)) {
+        remove(leftIndex);
+        i = leftIndex;
+        sz += size(leftIndex);
+    }
+    makeAvail(i,sz);
+    return true;
+}
 
+static void* firstFit(int ints) {
     int p = avail;
     sanity(p);
 
@@ -159,7 +191,83 @@ void* malloc(size_t bytes) {
             p = next(p);
         }
     }
+    return res;
+}
+
+Heap::Account* Heap::payer() {
+    Process* me = Process::current;
+    return (me == nullptr) ? nullptr : me->heapAccount;
+}
+
+void Heap::charge(Account* account, uint32_t bytes) {
+    if (account == nullptr) return;
+    account->bytes += bytes;
+    account->refs ++;
+}
+
+void Heap::refund(Account* account, uint32_t bytes) {
+    if (account == nullptr) return;
+    account->bytes -= bytes;
+    account->refs --;
+    if (account->refs == 0) free(account);
+}
+
+/* a block of ints with the account word after its header, nullptr if
+   the heap is full */
+static void* allocate(int ints, Heap::Account* account) {
+    Process::disable();
+    int* res = (int*) firstFit(ints);
+    if ((res == 0) && grow(ints)) {
+        res = (int*) firstFit(ints);
+    }
+    if (res != 0) {
+        res[0] = (int) account;
+        Heap::charge(account,size(res - array - 1) * 4);
+        res ++;
+    }
     Process::enable();
+    return res;
+}
+
+Heap::Account* Heap::open() {
+    /* not charged to anyone */
+    Account* account = (Account*) allocate(3 + (sizeof(Account) + 3) / 4,nullptr);
+    if (account == nullptr) {
+        Debug::panic("heap is full, no room for an account");
+    }
+    account->bytes = 0;
+    account->frames = 0;
+    account->refs = 1;
+    return account;
+}
+
+Heap::Account* Heap::hold(Account* account) {
+    if (account == nullptr) return nullptr;
+    Process::disable();
+    account->refs ++;
+    Process::enable();
+    return account;
+}
+
+void Heap::close(Account* account) {
+    Process::disable();
+    account->refs --;
+    bool last = (account->refs == 0);
+    Process::enable();
+    if (last) free(account);
+}
+
+extern "C"
+void* malloc(size_t bytes) {
+    //Debug::printf("malloc(%d)\n",bytes);
+    if (bytes == 0) return (void*) array;
+    if (bytes >= VMalloc::LARGE) return VMalloc::alloc(bytes,Heap::payer());
+
+    /* header, account and footer */
+    int ints = ((bytes + 3) / 4) + 3;
+    if (ints < 4) ints = 4;
+
+    void* res = allocate(ints,Heap::payer());
     if (res == 0) {
         Debug::panic("heap is full, bytes=0x%x",bytes);
     }
@@ -170,10 +278,14 @@ extern "C"
 void free(void* p) {
     if (p == 0) return;
     if (p == (void*) array) return;
+    if (VMalloc::owns(p)) {
+        VMalloc::free(p);
+        return;
+    }
 
     Process::disable();
 
-    int idx = ((((uintptr_t) p) - ((uintptr_t) array)) / 4) - 1;
+    int idx = ((((uintptr_t) p) - ((uintptr_t) array)) / 4) - 2;
     sanity(idx);
     if (!isTaken(idx)) {
         Debug::panic("freeing free block %p %d\n",p,idx);
@@ -181,6 +293,8 @@ void free(void* p) {
     }
 
     int sz = size(idx);
+    Heap::Account* account = (Heap::Account*) array[idx + 1];
+    int taken = sz;
 
     int leftIndex = left(idx);
     int rightIndex = right(idx);
@@ -197,6 +311,7 @@ void free(void* p) {
     }
 
     makeAvail(idx,sz);
+    Heap::refund(account,taken * 4);
     Process::enable();
 }
     
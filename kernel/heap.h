@@ -3,9 +3,40 @@
 
 #include "stdint.h"
 
+/* The kernel heap lives in its own part of kernel virtual memory,
+   starts with bytes mapped and grows a page at a time up to limit.
+   Large requests go to VMalloc instead.
+
+   Every block is charged to the account of the process that was
+   running when it was allocated, and given back to the same account
+   when it's freed, whoever frees it */
 class Heap {
 public:
-    static void init(void* base, size_t bytes);
+    struct Account {
+        uint32_t bytes;     /* in blocks charged to it */
+        uint32_t frames;    /* shared memory frames charged to it */
+        uint32_t refs;      /* one per block or segment, and one for
+                               its process */
+    };
+
+    static void init(void* base, size_t bytes, size_t limit);
+
+    /* a new account, referenced by the caller */
+    static Account* open();
+    /* the process is gone, the account goes with its last block */
+    static void close(Account* account);
+
+    /* something other than a block (a shm segment) keeps the account
+       until it closes it; nullptr is fine */
+    static Account* hold(Account* account);
+
+    /* the account new blocks are charged to, nullptr if none */
+    static Account* payer();
+
+    /* precondition: disabled. A block of bytes charged to the account,
+       or given back; nullptr is fine */
+    static void charge(Account* account, uint32_t bytes);
+    static void refund(Account* account, uint32_t bytes);
 };
 
 #endif
@@ -36,6 +36,8 @@ static inline long getStatus(int drive) {
 // Status bits
 #define BSY	0x80
 #define DRDY	0x40
+#define DRQ	0x08
+#define ERR	0x01
     
 static inline int isBusy(int drive) {
     return getStatus(drive) & BSY;
@@ -59,13 +61,19 @@ static inline void waitForDrive(int drive) {
 }
    
 
-void IDE::readBlock(uint32_t sector, void* buf) {
-    uint32_t* buffer = (uint32_t*) buf;
+static inline void waitForData(int drive) {
+    while (!(getStatus(drive) & DRQ)) {
+        if (Process::current) {
+            Process::yield();
+        }
+    }
+}
+
+// start a one sector command
+static void command(int drive, uint32_t sector, int cmd) {
     int base = port(drive);
     int ch = channel(drive);
 
-    mutex.lock();
-
     waitForDrive(drive);
 
     outb(base + 2, 1);			// sector count
@@ -73,7 +81,16 @@ void IDE::readBlock(uint32_t sector, void* buf) {
     outb(base + 4, sector >> 8);	// bits 15 .. 8
     outb(base + 5, sector >> 16);	// bits 23 .. 16
     outb(base + 6, 0xE0 | (ch << 4) | ((sector >> 24) & 0xf));
-    outb(base + 7, 0x20);		// read with retry
+    outb(base + 7, cmd);
+}
+
+void IDE::readBlock(uint32_t sector, void* buf) {
+    uint32_t* buffer = (uint32_t*) buf;
+    int base = port(drive);
+
+    mutex.lock();
+
+    command(drive, sector, 0x20);	// read with retry
 
     waitForDrive(drive);
 
@@ -84,3 +101,59 @@ void IDE::readBlock(uint32_t sector, void* buf) {
     mutex.unlock();
 
 }
+
+void IDE::writeBlock(uint32_t sector, const void* buf) {
+    const uint32_t* buffer = (const uint32_t*) buf;
+    int base = port(drive);
+
+    mutex.lock();
+
+    command(drive, sector, 0x30);	// write with retry
+
+    waitForData(drive);
+
+    for (uint32_t i=0; i<blockSize/sizeof(uint32_t); i++) {
+        outl(base, buffer[i]);
+    }
+
+    // done when the drive is ready again
+    waitForDrive(drive);
+
+    mutex.unlock();
+}
+
+uint32_t IDE::sectors() {
+    int base = port(drive);
+    int ch = channel(drive);
+
+    mutex.lock();
+
+    // nobody home reads as all zeros or all ones, don't wait for it
+    outb(base + 6, 0xA0 | (ch << 4));
+    long status = getStatus(drive);
+    if ((status == 0) || (status == 0xff)) {
+        mutex.unlock();
+        return 0;
+    }
+
+    outb(base + 7, 0xEC);		// identify
+    status = getStatus(drive);
+    for (uint32_t tries = 0; (status & BSY) && (tries < 100000); tries++) {
+        status = getStatus(drive);
+    }
+    if ((status == 0) || (status & (ERR | BSY)) || !(status & DRQ)) {
+        // not there, or not an ATA drive
+        mutex.unlock();
+        return 0;
+    }
+
+    uint32_t info[128];
+    for (uint32_t i=0; i<128; i++) {
+        info[i] = inl(base);
+    }
+
+    mutex.unlock();
+
+    // words 60 and 61, the LBA28 sector count
+    return info[30];
+}
@@ -12,6 +12,12 @@ public:
     IDE(int drive) : BlockDevice(SECTOR_SIZE), drive(drive) {}
 
     void readBlock(uint32_t blockNumber, void* buffer);
+
+    /* write one sector, only swap writes to a drive */
+    void writeBlock(uint32_t blockNumber, const void* buffer);
+
+    /* the size of the drive in sectors, 0 if there is no drive */
+    uint32_t sectors();
 };
 
 #endif
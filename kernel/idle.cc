@@ -1,9 +1,14 @@
 #include "idle.h"
 #include "err.h"
+#include "swap.h"
+#include "merge.h"
 
 long IdleProcess::run(void) {
     while (true) {
         Process::checkReaper();
+        /* nobody else wants the CPU, get ahead on memory */
+        Swap::idle();
+        Merge::idle();
 //        trace("idle");
 //        Debug::shutdown("idle");
         __asm__ __volatile__ ("hlt");
@@ -12,6 +12,12 @@
 #include "fs.h"
 #include "ide.h"
 #include "idle.h"
+#include "tty.h"
+#include "futex.h"
+#include "fpu.h"
+#include "kstack.h"
+#include "swap.h"
+#include "merge.h"
 
 extern "C"
 void kernelMain(void) {
@@ -52,18 +58,34 @@ void kernelMain(void) {
     /* Initialize system calls */
     Syscall::init();
 
+    /* Everything above 1M is page frames */
+    PhysMem::init(0x100000,PhysMem::probe());
+    Debug::printf("I have %dMB of memory\n",PhysMem::limit >> 20);
+
+    /* Kernel stacks come from page frames */
+    KernelStack::init();
+
+    /* Kernel page tables, paging is on from here */
+    KernelMemory::init();
+
     /* Initialize the heap */
-    Heap::init((void*)0x100000,0x100000);
+    Heap::init((void*)KernelMemory::HEAP_BASE,0x100000,
+        KernelMemory::HEAP_END - KernelMemory::HEAP_BASE);
     Debug::printf("I have a heap\n");
 
-    /* Make the rest of memory available for VM */
-    PhysMem::init(0x200000,0x400000);
+    /* The console line discipline */
+    Tty::init(new Tty(U8250::it));
 
     /* Initialize the process subsystem */
     Process::init();
     Process::DEBUG->off();
     Process::trace("Process tracing enabled");
 
+    Futex::init();
+
+    /* SSE for user programs, with lazy switching */
+    Fpu::init();
+
     Pic::init();                // initialize the PIC, still disabled
 
     Keyboard::init();           // initialize the keyboard
@@ -78,6 +100,14 @@ void kernelMain(void) {
     FileSystem::init(new Fat439(&hdd));
     Process::trace("initialized root filesystem");
 
+    /* compressed swap, and the drive on the other channel of the
+       second controller if it's there */
+    IDE swapDrive(2);
+    Swap::init(&swapDrive);
+
+    /* merging identical pages, from the idle process */
+    Merge::init(Swap::frameCount());
+
     /* Create the Primordial process */
     Process* initProcess = new Init();
 
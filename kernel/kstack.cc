@@ -0,0 +1,130 @@
+#include "kstack.h"
+#include "vmm.h"
+#include "process.h"
+#include "machine.h"
+#include "debug.h"
+
+#define PDE_FIRST (KernelStack::BASE >> 22)
+#define PDE_COUNT ((KernelStack::END - KernelStack::BASE) >> 22)
+
+/* the shared page tables, one per 4MB */
+static uint32_t* tables[PDE_COUNT];
+
+/* slot i is mapped (in use or cached) */
+static uint32_t mapped[(KernelStack::SLOTS + 31) / 32];
+
+/* the deepest use of each slot, in bytes, updated when it's released */
+static uint16_t deepest[KernelStack::SLOTS];
+
+/* freed stacks that kept their frames, used last in first out */
+static uint32_t cache[KernelStack::CACHE];
+static uint32_t cached = 0;
+
+static inline uint32_t slotBase(uint32_t slot) {
+    /* the guard page comes first */
+    return KernelStack::BASE + slot * KernelStack::SLOT + 4096;
+}
+
+static inline uint32_t& pte(uint32_t va) {
+    uint32_t i = (va - KernelStack::BASE) >> 12;
+    return tables[i >> 10][i & 0x3ff];
+}
+
+/* bytes of the stack that were ever used */
+static uint32_t used(uint32_t slot) {
+    uint32_t base = slotBase(slot);
+    for (uint32_t off = 0; off < KernelStack::BYTES; off += 4) {
+        uint32_t va = base + off;
+        uint32_t* p = (uint32_t*) ((pte(va) & 0xfffff000) | (va & 0xfff));
+        if (*p != 0) return KernelStack::BYTES - off;
+    }
+    return 0;
+}
+
+void KernelStack::init() {
+    for (uint32_t i = 0; i < PDE_COUNT; i++) {
+        tables[i] = (uint32_t*) PhysMem::alloc();
+    }
+}
+
+void KernelStack::mapInto(uint32_t* pd) {
+    for (uint32_t i = 0; i < PDE_COUNT; i++) {
+        /* kernel only */
+        pd[PDE_FIRST + i] = ((uint32_t) tables[i]) | AddressSpace::W | AddressSpace::P;
+    }
+}
+
+long* KernelStack::alloc() {
+    Process::disable();
+    uint32_t slot;
+    if (cached > 0) {
+        slot = cache[--cached];
+    } else {
+        slot = SLOTS;
+        for (uint32_t w = 0; w < (SLOTS + 31) / 32; w++) {
+            if (mapped[w] != 0xffffffff) {
+                slot = w * 32 + __builtin_ctz(~mapped[w]);
+                break;
+            }
+        }
+        if (slot >= SLOTS) {
+            Debug::panic("out of kernel stacks");
+        }
+        mapped[slot / 32] |= 1u << (slot % 32);
+        uint32_t base = slotBase(slot);
+        for (uint32_t va = base; va < base + BYTES; va += 4096) {
+            pte(va) = PhysMem::alloc() | AddressSpace::W | AddressSpace::P;
+        }
+    }
+    Process::enable();
+    return (long*) slotBase(slot);
+}
+
+void KernelStack::free(long* stack) {
+    uint32_t slot = ((uint32_t) stack - BASE) / SLOT;
+    Process::disable();
+    if (cached < CACHE) {
+        cache[cached++] = slot;
+    } else {
+        uint32_t depth = used(slot);
+        if (depth > deepest[slot]) deepest[slot] = depth;
+        uint32_t base = slotBase(slot);
+        for (uint32_t va = base; va < base + BYTES; va += 4096) {
+            uint32_t pa = pte(va) & 0xfffff000;
+            pte(va) = 0;
+            invlpg(va);
+            PhysMem::free(pa);
+        }
+        mapped[slot / 32] &= ~(1u << (slot % 32));
+    }
+    Process::enable();
+}
+
+long* KernelStack::direct(long* va) {
+    uint32_t v = (uint32_t) va;
+    return (long*) ((pte(v) & 0xfffff000) | (v & 0xfff));
+}
+
+bool KernelStack::isGuard(uint32_t va) {
+    if ((va < BASE) || (va >= END)) return false;
+    return ((va - BASE) % SLOT) < 4096;
+}
+
+void KernelStack::report() {
+    uint32_t worst = 0;
+    uint32_t count = 0;
+    Process::disable();
+    for (uint32_t slot = 0; slot < SLOTS; slot++) {
+        uint32_t depth = deepest[slot];
+        if (mapped[slot / 32] & (1u << (slot % 32))) {
+            uint32_t now = used(slot);
+            if (now > depth) depth = now;
+        }
+        if (depth == 0) continue;
+        count++;
+        if (depth > worst) worst = depth;
+        Debug::printf("kernel stack %d: %d of %d bytes\n",slot,depth,BYTES);
+    }
+    Process::enable();
+    Debug::printf("%d kernel stacks, deepest %d of %d bytes\n",count,worst,BYTES);
+}
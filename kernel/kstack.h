@@ -0,0 +1,51 @@
+#ifndef _KSTACK_H_
+#define _KSTACK_H_
+
+#include "stdint.h"
+
+/*
+ * Kernel stacks.
+ *
+ * Stacks live in a region of kernel virtual memory just below user
+ * space, mapped by page tables that every address space shares. Each
+ * slot is an unmapped guard page followed by the stack pages, so
+ * running off the bottom of a stack faults instead of scribbling on
+ * a neighbor.
+ *
+ * Freed stacks go to a small cache and keep their frames, so creating
+ * a process usually reuses one without touching the heap or zeroing
+ * anything. Frames come zeroed from PhysMem, which is how the high
+ * water mark is found: the deepest word that isn't zero.
+ */
+class KernelStack {
+public:
+    static constexpr uint32_t BASE = 0x7f800000;
+    static constexpr uint32_t END = 0x80000000;
+    static constexpr uint32_t PAGES = 2;
+    static constexpr uint32_t BYTES = PAGES * 4096;
+    static constexpr uint32_t SLOT = BYTES + 4096;
+    static constexpr uint32_t SLOTS = (END - BASE) / SLOT;
+    /* freed stacks kept mapped, there is only one CPU */
+    static constexpr uint32_t CACHE = 16;
+
+    static void init();
+
+    /* share the stack page tables with a new page directory */
+    static void mapInto(uint32_t* pd);
+
+    /* the lowest address of a free stack */
+    static long* alloc();
+    static void free(long* stack);
+
+    /* the same memory through the identity map, usable before
+       paging is on */
+    static long* direct(long* va);
+
+    /* is va a guard page */
+    static bool isGuard(uint32_t va);
+
+    /* print the deepest use of each stack */
+    static void report();
+};
+
+#endif
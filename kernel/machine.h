@@ -17,16 +17,31 @@ extern "C" void pit_do_init(int divide);
 extern "C" int inb(int port);
 extern "C" int inl(int port);
 extern "C" void outb(int port, int val);
+extern "C" void outl(int port, int val);
 
 extern "C" void ltr(uint32_t tr);
 
 extern "C" void pageFaultHandler();
 extern "C" void syscallTrap();
 
+extern "C" uint64_t rdtsc();
+
 extern "C" uint32_t getcr0();
+extern "C" void setcr0(uint32_t);
 extern "C" uint32_t getcr3();
+extern "C" void setcr3(uint32_t);
+extern "C" uint32_t getcr4();
+extern "C" void setcr4(uint32_t);
 extern "C" void invlpg(uint32_t);
 
+extern "C" uint32_t cpuidEdx(uint32_t leaf);
+
+extern "C" void fpuTrapHandler();
+extern "C" void clts();
+extern "C" void fninit();
+extern "C" void fxsave(void* area);
+extern "C" void fxrstor(void* area);
+
 
 extern "C" void cli(void);
 extern "C" void sti(void);
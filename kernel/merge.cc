@@ -0,0 +1,200 @@
+#include "merge.h"
+#include "swap.h"
+#include "futex.h"
+#include "vmm.h"
+#include "process.h"
+#include "machine.h"
+#include "debug.h"
+
+#define PAGE 4096
+#define BUCKETS 1024
+#define UNSTABLE 4096
+
+/* a merged frame */
+struct Shared {
+    Shared* next;       /* in its bucket */
+    uint32_t frame;
+    uint32_t sum;
+    uint32_t refs;
+};
+
+/* merged frames by checksum */
+static Shared* stable[BUCKETS];
+
+/* the merged frame each frame is, if it is one */
+static Shared** byFrame = nullptr;
+
+/* each frame's checksum from the last pass */
+static uint32_t* sums = nullptr;
+
+/* pages this pass whose checksum held still, by checksum, index + 1 */
+static uint32_t unstable[UNSTABLE];
+
+static uint32_t nFrames = 0;
+static uint32_t hand = 0;
+
+/* counters, saved is the references to merged frames beyond the
+   first one of each */
+static uint32_t merges = 0;
+static uint32_t zeroMerges = 0;
+static uint32_t saved = 0;
+static uint32_t nShared = 0;
+
+void Merge::init(uint32_t n) {
+    nFrames = n;
+    byFrame = new Shared*[n];
+    sums = new uint32_t[n];
+    for (uint32_t i = 0; i < n; i++) {
+        byFrame[i] = nullptr;
+        sums[i] = 0;
+    }
+    for (uint32_t i = 0; i < BUCKETS; i++) stable[i] = nullptr;
+    for (uint32_t i = 0; i < UNSTABLE; i++) unstable[i] = 0;
+}
+
+static uint32_t checksum(uint32_t frame) {
+    const uint32_t* w = (const uint32_t*) frame;
+    uint32_t h = 0;
+    for (uint32_t i = 0; i < PAGE / 4; i++) {
+        h = (h ^ w[i]) * 16777619;
+    }
+    return h;
+}
+
+static bool same(uint32_t a, uint32_t b) {
+    const uint32_t* x = (const uint32_t*) a;
+    const uint32_t* y = (const uint32_t*) b;
+    for (uint32_t i = 0; i < PAGE / 4; i++) {
+        if (x[i] != y[i]) return false;
+    }
+    return true;
+}
+
+/* precondition: disabled. Point the entry at a shared frame */
+static void remap(uint32_t* pte, uint32_t va, uint32_t frame, uint32_t bits) {
+    *pte = frame | (*pte & AddressSpace::U) | bits | AddressSpace::P;
+    invlpg(va);
+}
+
+/* precondition: disabled. Try to merge the page in frame i */
+static void scan(uint32_t i) {
+    AddressSpace* space;
+    uint32_t va;
+    uint32_t* pte = Swap::mapping(i,&space,&va);
+    if (pte == nullptr) return;
+    uint32_t frame = i * PAGE;
+    uint32_t sum = checksum(frame);
+    if (sum != sums[i]) {
+        /* still being written, maybe */
+        sums[i] = sum;
+        return;
+    }
+    if (Futex::waitedOn(frame)) return;
+
+    if (same(frame,AddressSpace::zeroFrame)) {
+        remap(pte,va,AddressSpace::zeroFrame,AddressSpace::CACHED | AddressSpace::COW);
+        space->resident.getThenAdd(-1);
+        Swap::untrack(frame);
+        PhysMem::free(frame);
+        zeroMerges ++;
+        return;
+    }
+
+    for (Shared* s = stable[sum % BUCKETS]; s != nullptr; s = s->next) {
+        if ((s->sum == sum) && same(frame,s->frame)) {
+            remap(pte,va,s->frame,AddressSpace::COW);
+            space->resident.getThenAdd(-1);
+            s->refs ++;
+            Swap::untrack(frame);
+            PhysMem::free(frame);
+            merges ++;
+            saved ++;
+            return;
+        }
+    }
+
+    uint32_t* seen = &unstable[sum % UNSTABLE];
+    uint32_t j = *seen - 1;
+    *seen = i + 1;
+    if ((j + 1 == 0) || (j == i) || (sums[j] != sum)) return;
+    AddressSpace* otherSpace;
+    uint32_t otherVA;
+    uint32_t* other = Swap::mapping(j,&otherSpace,&otherVA);
+    if ((other == nullptr) || !same(frame,j * PAGE) || Futex::waitedOn(j * PAGE)) return;
+
+    /* the other page's frame becomes the shared one */
+    Shared* s = new Shared();
+    s->frame = j * PAGE;
+    s->sum = sum;
+    s->refs = 2;
+    s->next = stable[sum % BUCKETS];
+    stable[sum % BUCKETS] = s;
+    byFrame[j] = s;
+    nShared ++;
+    *seen = 0;
+
+    remap(other,otherVA,s->frame,AddressSpace::COW);
+    otherSpace->resident.getThenAdd(-1);
+    Swap::untrack(s->frame);
+    remap(pte,va,s->frame,AddressSpace::COW);
+    space->resident.getThenAdd(-1);
+    Swap::untrack(frame);
+    PhysMem::free(frame);
+    merges ++;
+    saved ++;
+}
+
+void Merge::idle() {
+    if (byFrame == nullptr) return;
+    for (uint32_t n = 0; n < IDLE_BATCH; n++) {
+        Process::disable();
+        scan(hand);
+        hand ++;
+        if (hand == nFrames) {
+            /* a new pass */
+            hand = 0;
+            for (uint32_t i = 0; i < UNSTABLE; i++) unstable[i] = 0;
+        }
+        Process::enable();
+    }
+}
+
+void Merge::get(uint32_t frame) {
+    Process::disable();
+    Shared* s = byFrame[frame / PAGE];
+    if (s == nullptr) {
+        Debug::panic("merge: %x is not a merged frame",frame);
+    }
+    s->refs ++;
+    saved ++;
+    Process::enable();
+}
+
+void Merge::put(uint32_t frame) {
+    Process::disable();
+    Shared* s = byFrame[frame / PAGE];
+    if (s == nullptr) {
+        Debug::panic("merge: %x is not a merged frame",frame);
+    }
+    s->refs --;
+    if (s->refs != 0) {
+        saved --;
+        Process::enable();
+        return;
+    }
+    Shared** p = &stable[s->sum % BUCKETS];
+    while (*p != s) p = &(*p)->next;
+    *p = s->next;
+    byFrame[frame / PAGE] = nullptr;
+    nShared --;
+    Process::enable();
+
+    PhysMem::free(frame);
+    delete s;
+}
+
+void Merge::report() {
+    if (byFrame == nullptr) return;
+    Debug::printf("merge: %d pages merged, %d more became the zero page\n",merges,zeroMerges);
+    Debug::printf("merge: %d shared frames save %dKB now\n",nShared,(saved * PAGE) >> 10);
+}
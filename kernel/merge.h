@@ -0,0 +1,41 @@
+#ifndef _MERGE_H_
+#define _MERGE_H_
+
+#include "stdint.h"
+
+/*
+ * Same page merging.
+ *
+ * The idle process walks the private user frames in swap's reverse map
+ * and checksums them. A page whose checksum didn't change since the
+ * last pass is probably done being written, so it's compared with the
+ * merged frames that have the same checksum and, failing that, with
+ * another stable page seen this pass. Two identical pages become one
+ * read only frame that both entries map copy on write; a page of zeros
+ * becomes the zero page.
+ *
+ * A merged frame is mapped with COW but not CACHED, and holds one
+ * reference per entry that maps it. Fork adds one, a write copies the
+ * page and drops one, and the last one frees the frame.
+ */
+class Merge {
+public:
+    /* this many frames looked at every time the idle process runs */
+    static constexpr uint32_t IDLE_BATCH = 32;
+
+    static void init(uint32_t nFrames);
+
+    /* look at some more pages, called by the idle process */
+    static void idle();
+
+    /* another entry maps the merged frame */
+    static void get(uint32_t frame);
+
+    /* one less entry maps it, frees it after the last */
+    static void put(uint32_t frame);
+
+    /* print the counters */
+    static void report();
+};
+
+#endif
@@ -0,0 +1,125 @@
+#include "oom.h"
+#include "process.h"
+#include "ptable.h"
+#include "swap.h"
+#include "err.h"
+#include "debug.h"
+
+static Atomic32 kills;
+
+/* how much memory killing it would give back, in frames */
+static uint32_t size(Process* p) {
+    AddressSpace* space = p->addressSpace;
+    if ((space == nullptr) || p->isKilled || p->isKillPending() ||
+            (p == Process::idleProcess)) {
+        return 0;
+    }
+    return space->resident.get() + space->tables.get() + p->heapAccount->frames +
+        p->heapAccount->bytes / PhysMem::FRAME_SIZE;
+}
+
+static void killSharing(Process* p, void* space) {
+    if (p->addressSpace == space) p->signal(SIGKILL);
+}
+
+/* send SIGKILL to the threads using the address space. They may be
+   anywhere in the kernel, holding locks, so they act on it on their
+   way back to user mode, and killable waits let them get there */
+static void kill(AddressSpace* space) {
+    ProcessTable::forEach(killSharing,space);
+    kills.getThenAdd(1);
+}
+
+static bool overLimit(Process* p) {
+    uint32_t* limits = p->memLimits;
+    AddressSpace* space = p->addressSpace;
+    uint32_t resident = space->resident.get() + p->heapAccount->frames;
+    return ((limits[Oom::RESIDENT] != 0) && (resident > limits[Oom::RESIDENT])) ||
+        ((limits[Oom::TABLES] != 0) && (space->tables.get() > limits[Oom::TABLES])) ||
+        ((limits[Oom::HEAP] != 0) && (p->heapAccount->bytes > limits[Oom::HEAP]));
+}
+
+void Oom::check(bool fromUser) {
+    Process* me = Process::current;
+    /* someone counting on nothing changing under them */
+    if ((me == nullptr) || (me->disableCount != 0)) return;
+
+    if (overLimit(me) && !me->isKillPending()) {
+        Debug::printf("process %s %d is over its memory limit\n",me->name,me->id);
+        kill(me->addressSpace);
+    }
+    if (me->isKillPending()) {
+        /* coming in from user mode nothing is held and we can go now,
+           otherwise we go on the way back */
+        if (fromUser) me->kill(SIGKILL);
+        return;
+    }
+
+    if (PhysMem::freeFrames() >= RESERVE) return;
+    Swap::reclaim();
+    if (PhysMem::freeFrames() >= RESERVE) return;
+
+    Process* victim = ProcessTable::best(size);
+    if (victim == nullptr) return;
+    Debug::printf("out of memory, killing %s %d (%dKB)\n",victim->name,victim->id,
+        size(victim) * (PhysMem::FRAME_SIZE / 1024));
+    kill(victim->addressSpace);
+    Resource::unref(victim);
+    /* maybe it was us */
+    if (me->isKillPending()) {
+        if (fromUser) me->kill(SIGKILL);
+        return;
+    }
+
+    /* they give it back when they exit */
+    for (uint32_t n = 0; (n < PATIENCE) && (PhysMem::freeFrames() < RESERVE); n++) {
+        Process::yield();
+    }
+}
+
+long Oom::stats(long pid, MemStats* out) {
+    Process* p = (pid == 0) ? (Process*) Resource::ref(Process::current) : ProcessTable::get(pid);
+    if (p == nullptr) return ERR_NOT_FOUND;
+    out->resident = p->addressSpace->resident.get();
+    out->tables = p->addressSpace->tables.get();
+    out->heap = p->heapAccount->bytes;
+    out->shm = p->heapAccount->frames;
+    out->freeFrames = PhysMem::freeFrames();
+    out->totalFrames = PhysMem::limit / PhysMem::FRAME_SIZE;
+    out->oomKills = kills.get();
+    Resource::unref(p);
+    return 0;
+}
+
+long Oom::limit(long pid, long which, long value) {
+    if ((which < 0) || (which >= LIMITS)) return ERR_NOT_POSSIBLE;
+    Process* me = Process::current;
+    Process* p = ((pid == 0) || (pid == me->id)) ? (Process*) Resource::ref(me) :
+        ProcessTable::get(pid);
+    if (p == nullptr) return ERR_NOT_FOUND;
+    long rc;
+    if ((p != me) && (p->parent != me)) {
+        /* only our own children */
+        rc = ERR_NOT_POSSIBLE;
+    } else {
+        uint32_t old = p->memLimits[which];
+        /* a limit can only come down, or the process it's meant to
+           hold back would lift it */
+        bool raise = (value == 0) || ((old != 0) && ((uint32_t) value > old));
+        rc = old;
+        if (value >= 0) {
+            if (raise) {
+                rc = ERR_NOT_POSSIBLE;
+            } else {
+                p->memLimits[which] = value;
+            }
+        }
+    }
+    Resource::unref(p);
+    return rc;
+}
+
+void Oom::report() {
+    if (kills.get() == 0) return;
+    Debug::printf("oom: %d processes killed for memory\n",kills.get());
+}
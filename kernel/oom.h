@@ -0,0 +1,69 @@
+#ifndef _OOM_H_
+#define _OOM_H_
+
+#include "stdint.h"
+
+/* what memstat fills in, the layout of the user's memstats */
+struct MemStats {
+    uint32_t resident;      /* private frames its address space maps */
+    uint32_t tables;        /* page table frames, with the directory */
+    uint32_t heap;          /* kernel heap bytes charged to it */
+    uint32_t shm;           /* shared memory frames charged to it */
+    uint32_t freeFrames;
+    uint32_t totalFrames;
+    uint32_t oomKills;      /* processes killed for memory so far */
+};
+
+/*
+ * Memory limits, and what happens when memory runs out.
+ *
+ * A process can be limited in the private frames its address space
+ * maps with the shared memory frames of segments it created, the page
+ * table frames it uses and the kernel heap charged to it; 0 means no
+ * limit, and children and threads start with their creator's limits. Limits are set by the process or its parent and
+ * only ever come down, like a hard rlimit. A process over one of them
+ * is killed the next time it faults or makes a system call.
+ *
+ * Running out is noticed at the same places. When swap can't get more
+ * than RESERVE frames free, the process using the most (its frames,
+ * page tables and heap pages together) is sent SIGKILL with every
+ * thread sharing its address space, and the process that noticed
+ * yields until they have exited and given their memory back. The reserve is left for
+ * the kernel, which still panics if it runs out itself.
+ */
+class Oom {
+public:
+    /* the limits */
+    enum {
+        RESIDENT = 0,       /* frames */
+        TABLES = 1,         /* frames */
+        HEAP = 2,           /* bytes */
+        LIMITS = 3
+    };
+
+    /* user memory stops here, the rest is for the kernel */
+    static constexpr uint32_t RESERVE = 32;
+
+    /* how many times to yield waiting for a victim to die */
+    static constexpr uint32_t PATIENCE = 100;
+
+    /* on the way into system calls and page faults on user memory.
+       fromUser: the fault came from user mode or it's a system call,
+       nothing is held and the caller may exit here; otherwise a caller
+       that is killed exits on its way back to user mode */
+    static void check(bool fromUser = true);
+
+    /* the counters of process pid, 0 for the caller */
+    static long stats(long pid, MemStats* out);
+
+    /* lower one of the limits of process pid, 0 for the caller, which
+       has to be the caller or one of its children. value < 0 only
+       looks; raising or removing a limit isn't possible. Returns the
+       old one */
+    static long limit(long pid, long which, long value);
+
+    /* print the counters */
+    static void report();
+};
+
+#endif
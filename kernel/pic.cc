@@ -5,6 +5,7 @@
 #include "debug.h"
 #include "process.h"
 #include "kbd.h"
+#include "tty.h"
 
 #define C1 0x20           /* command port for PIC1 */
 #define D1 (C1 + 1)       /* data port for PIC1 */
@@ -93,19 +94,19 @@ extern "C" void pic_irq(int irq, regs *registers) {
     switch (irq) {
     case 0: Pit::handler(); break;
     case 1: /*Keyboard::handler();*/ break;
-    case 4: /*com1 */ break;
+    case 4: /*com1 */ Tty::handler(); break;
     case 15: /* ide */ break;
     default: Debug::printf("interrupt %d\n",irq);
     }
     pic_eoi(irq); /* the PIC can deliver the next interrupt,
                      but interrupts are still disabled */
 
-    // save user context
-    if (Process::current && registers->eip >= 0x80000000){
-        //Debug::printf("registers = %X\n", registers);
-        *(Process::current->context->registers) = *registers;
-    }
-
     Process::yield();
     Process::endIrq();
+
+    // going back to user space, deliver signals first. That can fault
+    // the user stack in, so it waits until the interrupt is over
+    if (registers->eip >= 0x80000000) {
+        Signal::checkSignals(registers);
+    }
 }
@@ -0,0 +1,164 @@
+#include "pipe.h"
+#include "process.h"
+#include "machine.h"
+#include "vmm.h"
+#include "err.h"
+
+/**************/
+/* PipeBuffer */
+/**************/
+
+static uint32_t min(uint32_t a, uint32_t b) {
+    return (a < b) ? a : b;
+}
+
+PipeBuffer::PipeBuffer() : Resource(ResourceType::OTHER),
+    head(0), used(0), readers(1), writers(1)
+{
+    data = (char*) PhysMem::alloc();
+}
+
+PipeBuffer::~PipeBuffer() {
+    PhysMem::free((uint32_t) data);
+    data = nullptr;
+}
+
+/* precondition: interrupts are disabled */
+void PipeBuffer::wakeAll(SimpleQueue<Process*> *q) {
+    while (!q->isEmpty()) {
+        q->removeHead()->makeReady();
+    }
+}
+
+int32_t PipeBuffer::read(void* buf, uint32_t length) {
+    if (length == 0) return 0;
+
+    /* buf is user memory and copying into it can fault and block, so
+       bytes go through this under disable and out to buf after */
+    char chunk[CHUNK];
+    char* p = (char*) buf;
+    uint32_t n = 0;
+
+    Process::disable();
+    while ((used == 0) && (writers > 0)) {
+        if (!Process::yieldKillable(&waitingReaders)) {
+            Process::enable();
+            return ERR_NOT_POSSIBLE;
+        }
+    }
+
+    /* whatever is there now, no more waiting */
+    while (n < length) {
+        uint32_t m = min(min(length - n, CHUNK), used);
+        if (m == 0) break;
+
+        /* at most two copies, one on each side of the wrap */
+        uint32_t first = min(m, SIZE - head);
+        memcpy(chunk, &data[head], first);
+        memcpy(chunk + first, data, m - first);
+        head = (head + m) % SIZE;
+        used -= m;
+        wakeAll(&waitingWriters);
+        pollers.wakeAll();
+
+        Process::enable();
+        memcpy(p + n, chunk, m);
+        n += m;
+        Process::disable();
+    }
+    Process::enable();
+    return n;
+}
+
+int32_t PipeBuffer::write(const void* buf, uint32_t length) {
+    /* the other way around, a chunk of buf is copied in before disable */
+    char chunk[CHUNK];
+    const char* p = (const char*) buf;
+    uint32_t togo = length;
+
+    while (togo > 0) {
+        uint32_t m = min(togo, CHUNK);
+        memcpy(chunk, p, m);
+        p += m;
+        togo -= m;
+
+        const char* q = chunk;
+        Process::disable();
+        while (m > 0) {
+            while ((used == SIZE) && (readers > 0)) {
+                if (!Process::yieldKillable(&waitingWriters)) {
+                    Process::enable();
+                    return ERR_NOT_POSSIBLE;
+                }
+            }
+            if (readers == 0) {
+                Process::enable();
+                return ERR_BROKEN_PIPE;
+            }
+
+            uint32_t tail = (head + used) % SIZE;
+            uint32_t n = min(m, SIZE - used);
+            uint32_t first = min(n, SIZE - tail);
+            memcpy(&data[tail], q, first);
+            memcpy(data, q + first, n - first);
+            used += n;
+            q += n;
+            m -= n;
+
+            wakeAll(&waitingReaders);
+            pollers.wakeAll();
+        }
+        Process::enable();
+    }
+    return length;
+}
+
+void PipeBuffer::closeEnd(bool writer) {
+    Process::disable();
+    if (writer) {
+        writers --;
+        /* readers see end of file */
+        wakeAll(&waitingReaders);
+    } else {
+        readers --;
+        /* writers see a broken pipe */
+        wakeAll(&waitingWriters);
+    }
+    pollers.wakeAll();
+    Process::enable();
+}
+
+/* precondition: interrupts are disabled */
+long PipeBuffer::poll(bool writer, long events) {
+    if (writer) {
+        return ((used < SIZE) || (readers == 0)) ? (events & POLLOUT) : 0;
+    } else {
+        return ((used > 0) || (writers == 0)) ? (events & POLLIN) : 0;
+    }
+}
+
+/********/
+/* Pipe */
+/********/
+
+Pipe::Pipe(PipeBuffer *buffer, bool writer) : Resource(ResourceType::PIPE),
+    buffer(buffer), writer(writer)
+{
+    Resource::ref(buffer);
+}
+
+Pipe::~Pipe() {
+    buffer->closeEnd(writer);
+    Resource::unref(buffer);
+    buffer = nullptr;
+}
+
+int32_t Pipe::read(void* buf, uint32_t length) {
+    if (writer) return ERR_NOT_POSSIBLE;
+    return buffer->read(buf,length);
+}
+
+int32_t Pipe::write(const void* buf, uint32_t length) {
+    if (!writer) return ERR_NOT_POSSIBLE;
+    return buffer->write(buf,length);
+}
@@ -0,0 +1,67 @@
+#ifndef _PIPE_H_
+#define _PIPE_H_
+
+#include "resource.h"
+#include "queue.h"
+#include "stdint.h"
+#include "poll.h"
+
+class Process;
+
+/*
+ * The shared part of a pipe: a page-sized ring buffer and the
+ * processes waiting on it. It lives until both ends are gone.
+ */
+class PipeBuffer : public Resource {
+    char *data;
+    uint32_t head;          // next byte to read
+    uint32_t used;          // bytes in the buffer
+    uint32_t readers;       // open read ends
+    uint32_t writers;       // open write ends
+    SimpleQueue<Process*> waitingReaders;
+    SimpleQueue<Process*> waitingWriters;
+    PollQueue pollers;
+
+    static void wakeAll(SimpleQueue<Process*> *q);
+public:
+    static constexpr uint32_t SIZE = (1 << 12);
+    /* bytes copied to or from user memory at a time */
+    static constexpr uint32_t CHUNK = 256;
+
+    PipeBuffer();
+    virtual ~PipeBuffer();
+
+    int32_t read(void* buf, uint32_t length);
+    int32_t write(const void* buf, uint32_t length);
+    void closeEnd(bool writer);
+
+    long poll(bool writer, long events);
+    PollQueue* pollQueue() { return &pollers; }
+};
+
+/*
+ * One end of a pipe, this is what lives in a descriptor table.
+ *
+ * Forking shares the end (the default Resource::forkMe) so the reader
+ * only sees end of file once every copy of the write end is closed.
+ */
+class Pipe : public Resource {
+    PipeBuffer *buffer;
+public:
+    const bool writer;
+
+    Pipe(PipeBuffer *buffer, bool writer);
+    virtual ~Pipe();
+
+    /* returns the number of bytes read, 0 => end of file */
+    int32_t read(void* buf, uint32_t length);
+    /* returns length, or an error if nobody will ever read */
+    int32_t write(const void* buf, uint32_t length);
+
+    /* the read end is readable when read would not block, the write
+       end is writable when write would make progress */
+    virtual long poll(long events) { return buffer->poll(writer,events); }
+    virtual PollQueue* pollQueue() { return buffer->pollQueue(); }
+};
+
+#endif
@@ -0,0 +1,154 @@
+#include "poll.h"
+#include "process.h"
+#include "pit.h"
+#include "err.h"
+
+/*************/
+/* PollQueue */
+/*************/
+
+void PollQueue::add(PollEntry *e) {
+    e->prev = nullptr;
+    e->next = first;
+    if (first) {
+        first->prev = e;
+    }
+    first = e;
+}
+
+void PollQueue::remove(PollEntry *e) {
+    if (e->prev) {
+        e->prev->next = e->next;
+    } else {
+        first = e->next;
+    }
+    if (e->next) {
+        e->next->prev = e->prev;
+    }
+    e->prev = nullptr;
+    e->next = nullptr;
+}
+
+void PollQueue::wakeAll() {
+    for (PollEntry *e = first; e != nullptr; e = e->next) {
+        e->poller->signal(e);
+    }
+}
+
+/**********/
+/* Poller */
+/**********/
+
+/* precondition: interrupts are disabled */
+void Poller::signal(PollEntry *e) {
+    if (!e->isQueued) {
+        e->isQueued = true;
+        e->nextReady = ready;
+        ready = e;
+    }
+    if (!woken) {
+        woken = true;
+        if (!waiting.isEmpty()) {
+            waiting.removeHead()->makeReady();
+        }
+    }
+}
+
+/* precondition: interrupts are disabled */
+void Poller::timeout() {
+    timedOut = true;
+    if (!woken) {
+        woken = true;
+        if (!waiting.isEmpty()) {
+            waiting.removeHead()->makeReady();
+        }
+    }
+}
+
+/* precondition: interrupts are disabled */
+bool Poller::block() {
+    if (!woken) {
+        if (!Process::yieldKillable(&waiting)) return false;
+    }
+    woken = false;
+    return true;
+}
+
+long Poller::poll(Table *table, pollfd *fds, long n, long timeout) {
+    /* more than the table can hold would only be duplicates */
+    if ((n < 0) || (n > Table::LIMIT)) return ERR_NOT_POSSIBLE;
+
+    Poller *poller = new Poller();
+    Resource::ref(poller);
+    PollEntry *entries = new PollEntry[n];
+    long count = 0;
+
+    Process::disable();
+
+    /* the first scan looks at everything and registers interest */
+    for (long i=0; i<n; i++) {
+        PollEntry *e = &entries[i];
+        Resource *res = table->get(fds[i].fd);
+        fds[i].revents = 0;
+        if (res == nullptr) {
+            fds[i].revents = POLLNVAL;
+            count ++;
+            continue;
+        }
+        fds[i].revents = res->poll(fds[i].events);
+        if (fds[i].revents != 0) {
+            count ++;
+        }
+        PollQueue *q = res->pollQueue();
+        if (q != nullptr) {
+            e->poller = poller;
+            e->res = Resource::ref(res);
+            e->index = i;
+            q->add(e);
+        }
+    }
+
+    if ((count == 0) && (timeout != 0)) {
+        if (timeout > 0) {
+            Process::wakeAt(Pit::jiffies + (timeout * Pit::hz + 999) / 1000,
+                (Poller*) Resource::ref(poller));
+        }
+
+        /* after that we only look at what was signalled */
+        while (count == 0) {
+            /* killed, it never sees the result */
+            if (!poller->block()) break;
+            while (poller->ready != nullptr) {
+                PollEntry *e = poller->ready;
+                poller->ready = e->nextReady;
+                e->isQueued = false;
+
+                long i = e->index;
+                if (fds[i].revents == 0) {
+                    fds[i].revents = e->res->poll(fds[i].events);
+                    if (fds[i].revents != 0) {
+                        count ++;
+                    }
+                }
+            }
+            if (poller->timedOut) break;
+        }
+    }
+
+    for (long i=0; i<n; i++) {
+        PollEntry *e = &entries[i];
+        if (e->res != nullptr) {
+            e->res->pollQueue()->remove(e);
+        }
+    }
+
+    Process::enable();
+
+    for (long i=0; i<n; i++) {
+        Resource::unref(entries[i].res);
+    }
+    delete[] entries;
+    Resource::unref(poller);
+
+    return count;
+}
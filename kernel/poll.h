@@ -0,0 +1,81 @@
+#ifndef _POLL_H_
+#define _POLL_H_
+
+#include "resource.h"
+#include "queue.h"
+#include "stdint.h"
+
+class Process;
+class Table;
+class Poller;
+
+/* The layout of the user's poll array */
+struct pollfd {
+    long fd;
+    long events;
+    long revents;
+};
+
+/* poll events, same values as Linux */
+#define POLLIN 1
+#define POLLOUT 4
+#define POLLNVAL 32
+
+/* One watched descriptor of one poll call */
+class PollEntry {
+public:
+    Poller *poller;
+    Resource *res;
+    long index;             // position in the user's array
+    PollEntry *prev;        // on the resource's PollQueue
+    PollEntry *next;
+    PollEntry *nextReady;   // on the poller's ready list
+    bool isQueued;
+
+    PollEntry() : poller(nullptr), res(nullptr), index(0),
+        prev(nullptr), next(nullptr), nextReady(nullptr), isQueued(false) {}
+};
+
+/*
+ * Embedded in every resource that can be polled. The resource calls
+ * wakeAll whenever it might have become ready, which only touches the
+ * pollers that are watching it.
+ *
+ * precondition for all methods: interrupts are disabled
+ */
+class PollQueue {
+    PollEntry *first;
+public:
+    PollQueue() : first(nullptr) {}
+    void add(PollEntry *e);
+    void remove(PollEntry *e);
+    void wakeAll();
+};
+
+/*
+ * A process blocked in poll. Heap allocated and reference counted
+ * because a pending timeout can outlive the poll call.
+ */
+class Poller : public Resource {
+    bool woken;
+    bool timedOut;
+    PollEntry *ready;       // entries that were signalled since last time
+    SimpleQueue<Process*> waiting;
+
+    /* false if the caller was killed instead */
+    bool block();
+public:
+    Poller() : Resource(ResourceType::OTHER),
+        woken(false), timedOut(false), ready(nullptr) {}
+
+    /* an entry's resource might be ready */
+    void signal(PollEntry *e);
+    /* the timeout expired */
+    void timeout();
+
+    /* poll n descriptors of the table, timeout is in ms (< 0 => forever)
+       returns the number of descriptors with non-zero revents */
+    static long poll(Table *table, pollfd *fds, long n, long timeout);
+};
+
+#endif
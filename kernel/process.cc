@@ -10,10 +10,14 @@
 #include "fs.h"
 #include "err.h"
 #include "libk.h"
+#include "tty.h"
+#include "fpu.h"
+#include "ptable.h"
+#include "kstack.h"
 
 /* global process declarations */
 Debug* Process::DEBUG;                          // the debug channel
-size_t Process::STACK_LONGS = 1024 * 2;         // default kernel stack size
+size_t Process::STACK_LONGS = KernelStack::BYTES / sizeof(long); // kernel stack size
 SimpleQueue<Process*> *Process::readyQueue;     // the ready queue
 SimpleQueue<Process*> *Process::reaperQueue;    // the reaper queue
 Process* Process::current;                      // the current process
@@ -65,68 +69,81 @@ extern "C" void runProcess() {
     Process::current->entry();
 }
 
-/* A bit of room to detect stack overflow without
-   corrupting neighbors */
-#define FUDGE 128
-
-Process::Process(const char* name, Table *resources_) :
-    Resource(ResourceType::PROCESS), name(name), parent(nullptr), resources(resources_)
+Process::Process(const char* name, Table *resources_, AddressSpace *addressSpace_) :
+    Resource(ResourceType::PROCESS), name(name), addressSpace(addressSpace_),
+    vforkDone(nullptr), parent(nullptr), children(nullptr),
+    nextSibling(nullptr), pidNext(nullptr), resources(resources_)
 {
     //Debug::printf("Process::Process %p\n",this);
     id = nextId.getThenAdd(1);
     iDepth = 0;
     iCount = 0;
     isKilled = false;
+    killableQueue = nullptr;
+    killWoken = false;
     killCode = 0;
     disableCount = 0;
-    stack = new long[FUDGE + STACK_LONGS];
-    if (stack == 0) {
-        Debug::panic("can't allocate stack");
+    fpuState = nullptr;
+    heapAccount = Heap::open();
+    for (uint32_t i = 0; i < Oom::LIMITS; i++) {
+        memLimits[i] = (current == nullptr) ? 0 : current->memLimits[i];
     }
-    stack = &stack[FUDGE];
+    stack = KernelStack::alloc();
     //Debug::printf("stack=%X\n",stack);
-    int idx = STACK_LONGS;
-    stack[--idx] = 0;
-    stack[--idx] = (long) runProcess;
-    stack[--idx] = 0; /* %ebx */
-    stack[--idx] = 0; /* %esi */
-    stack[--idx] = 0; /* edi */
-    stack[--idx] = 0; /* ebp */
-    kesp = (long) &stack[idx];
+    /* paging may not be on yet, go through the identity map */
+    long* top = KernelStack::direct(&stack[STACK_LONGS - 1]) + 1;
+    int idx = 0;
+    top[--idx] = 0;
+    top[--idx] = (long) runProcess;
+    top[--idx] = 0; /* %ebx */
+    top[--idx] = 0; /* %esi */
+    top[--idx] = 0; /* edi */
+    top[--idx] = 0; /* ebp */
+    kesp = (long) &stack[STACK_LONGS + idx];
 
     /* Resource table */
     if (resources == nullptr) {
-        resources = new Table(100);
+        resources = new Table();
+        resources->openAt(Table::STDIN, Tty::console);
+        resources->openAt(Table::STDOUT, Tty::console);
     }
     Resource::ref(resources);
+    resources->users.getThenAdd(1);
 
-    signalMutex = new Mutex();
+    /* Address space */
+    if (addressSpace == nullptr) {
+        addressSpace = new AddressSpace();
+    }
+    Resource::ref(addressSpace);
 
-    signalMutex->lock();
-    signalQueue = new SimpleQueue<Signal*>();
     context = new sigcontext();
     Signal::initHandlers(signalHandlers);
-    signalMutex->unlock();
-
-    inSignal = false;
+    signalMask = 0;
 
     /* We always start with a refcount of 1 */
     count.set(1);
+
+    ProcessTable::add(this);
 }
 
 Process::~Process() {
+    ProcessTable::remove(this);
+    Fpu::release(this);
     delete context;
-    delete signalQueue;
-    delete signalMutex;
 
     if (stack) {
-        delete[] (stack - FUDGE);
+        KernelStack::free(stack);
         stack = 0;
     }
     if (resources) {
         Resource::unref(resources);
         resources = nullptr;
     }
+    if (addressSpace) {
+        Resource::unref(addressSpace);
+        addressSpace = nullptr;
+    }
+    Heap::close(heapAccount);
 }
 
 void Process::start() {
@@ -145,6 +162,11 @@ void Process::kill(long code) {
 }
 
 long Process::execv(const char* fileName, SimpleQueue<const char*> *args, long argc) {
+    /* the other threads are still running in this address space */
+    if (resources->users.get() > 1) {
+        return ERR_NOT_POSSIBLE;
+    }
+
     File *prog = FileSystem::rootfs->rootdir->lookupFile(fileName);
     if (prog == nullptr) {
         return ERR_NOT_FOUND;
@@ -153,7 +175,22 @@ long Process::execv(const char* fileName, SimpleQueue<const char*> *args, long a
     name = K::strdup(fileName);
 
     /* Prepare address space for exec */
-    addressSpace.exec();
+    if (vforkDone) {
+        /* give the borrowed one back */
+        AddressSpace* fresh = new AddressSpace();
+        Resource::ref(fresh);
+        AddressSpace* borrowed = addressSpace;
+        Process::disable();
+        addressSpace = fresh;
+        fresh->activate();
+        Process::enable();
+        Resource::unref(borrowed);
+        vforkDone->up();
+        vforkDone = nullptr;
+    } else {
+        addressSpace->exec();
+    }
+    Fpu::release(this);
 
     /* copy args */
 
@@ -200,8 +237,16 @@ long Process::execv(const char* fileName, SimpleQueue<const char*> *args, long a
     userStack[0] = argc;
     userStack[1] = (long) userArgs; /* argv */
 
-    /* clear resources */
-    resources->closeAll();
+    /* clear resources, standard input and output stay open */
+    resources->closeAll(Table::RESERVED);
+
+    /* the handlers were in the old image */
+    for (int i = 0; i < SIGNUM; i++) {
+        if (getSignalAction((signal_t)i) == HANDLE) {
+            signalHandlers[i] = (uint32_t)Signal::defaultDisposition((signal_t)i);
+        }
+    }
+    context->frame = nullptr;
 
     /* read ELF */
     Elf32_Ehdr hdr;
@@ -219,9 +264,32 @@ long Process::execv(const char* fileName, SimpleQueue<const char*> *args, long a
 
         if (phdr.p_type == PT_LOAD) {
             char *p = (char*) phdr.p_vaddr;
-            //uint32_t memsz = phdr.p_memsz;
             uint32_t filesz = phdr.p_filesz;
 
+            /* the heap starts after the program */
+            uint32_t end = phdr.p_vaddr + phdr.p_memsz;
+            if (end > addressSpace->heapStart) {
+                addressSpace->heapStart = end;
+                addressSpace->heapEnd = end;
+            }
+
+            /* read only segments that line up with the file's pages are
+               mapped straight from its page cache, shared by everyone
+               running the program */
+            Pager* pager = prog->pager();
+            uint32_t inPage = phdr.p_vaddr & 0xfff;
+            if ((pager != nullptr) && ((phdr.p_flags & PF_W) == 0) &&
+                    (phdr.p_memsz == filesz) && ((phdr.p_offset & 0xfff) == inPage)) {
+                uint32_t va = phdr.p_vaddr - inPage;
+                uint32_t n = (phdr.p_offset - inPage) / PhysMem::FRAME_SIZE;
+                for (; va < end; va += PhysMem::FRAME_SIZE, n++) {
+                    uint32_t frame = pager->page(n);
+                    if (frame == 0) break;
+                    addressSpace->share(va,frame);
+                }
+                continue;
+            }
+
             prog->seek(phdr.p_offset);
             prog->readFully(p,filesz);
         }
@@ -252,6 +320,7 @@ bool Process::isReady() {
 void Process::makeReady() {
     disable();
     state = READY;
+    killableQueue = nullptr;
     if (this != idleProcess) {
         readyQueue->addTail(this);
     }
@@ -296,22 +365,58 @@ void Process::exit(long exitCode) {
 
     if (p) {
         //trace("%s#%d %X exiting", p->name, p->id, p);
-        p->inSignal = false;
+        bool borrowed = (p->vforkDone != nullptr);
+        if (p->vforkDone) {
+            p->vforkDone->up();
+            p->vforkDone = nullptr;
+        }
 
         p->exitCode = exitCode;
-        p->resources->closeAll();
+        // the last thread out closes the shared table
+        bool last = (p->resources->users.getThenAdd(-1) == 1);
+        if (last) {
+            p->resources->closeAll();
+        }
         p->onExit();
 
-        // signal or wake up the parent
-        p->doneEvent.signal();
-        if(p->parent){
-            p->parent->signal(SIGCHLD);
+        // and gives the memory back now, the process may not be waited
+        // for until much later. Not if it's its vfork parent's
+        if (last && !borrowed) {
+            p->addressSpace->clear();
+        }
+
+        // we do not want the children to signal us
+        Process::disable();
+        Process* orphans = p->children;
+        p->children = nullptr;
+        for (Process* c = orphans; c != nullptr; c = c->nextSibling) {
+            c->parent = nullptr;
+        }
+        Process::enable();
+        while (orphans != nullptr) {
+            Process* c = orphans;
+            orphans = c->nextSibling;
+            c->nextSibling = nullptr;
+            Resource::unref(c);
         }
 
+        p->doneEvent.signal();
+
         Process::disable();
+        ProcessTable::remove(p);
         reaperQueue->addTail(p);
         //Debug::printf("reaperQueue += %X\n",p);
         p->state = TERMINATED;
+        p->pollers.wakeAll();
+
+        // signal or wake up the parent
+        Process* parent = p->parent;
+        if (parent) {
+            parent->signal(SIGCHLD);
+            while (!parent->childWaiters.isEmpty()) {
+                parent->childWaiters.removeHead()->makeReady();
+            }
+        }
         current = nullptr;
 
         yield();
@@ -336,23 +441,22 @@ void Process::dispatch(Process *prev) {
     }
 
     if (this != prev) {
-        addressSpace.activate();
+        // no need to flush the TLB when switching between threads
+        if ((prev == nullptr) || (prev->addressSpace != addressSpace)) {
+            addressSpace->activate();
+        }
         TSS::esp0((uint32_t) &stack[STACK_LONGS]);
+        Fpu::switchTo(this);
+        if (Trace::enabled && (deliverableSignals() != 0)) {
+            Trace::record(Trace::SIG_DISPATCH, id,
+                __builtin_ctz(deliverableSignals()));
+        }
         current = this;
         contextSwitch(
                 prev ? &prev->kesp : 0, kesp, (disableCount == 0) ? (1<<9) : 0);
     }
 
     checkKilled();
-
-    //Debug::printf("going to check signals\n");
-    if( !inSignal ){ // we do not want recursive signal handling
-        inSignal = true;
-        Signal::checkSignals(Process::current->signalQueue);
-        inSignal = false;
-    }
-    //    Debug::printf("checked signals\n");
-
 }
 
 void Process::yield(Queue<Process*> *q) {
@@ -395,6 +499,25 @@ void Process::yield() {
     yield(nullptr);
 }
 
+bool Process::yieldKillable(Queue<Process*> *q) {
+    Process* me = current;
+    if (me->isKillPending()) return false;
+    me->killableQueue = q;
+    me->killWoken = false;
+    yield(q);
+    return !me->killWoken;
+}
+
+void Process::wakeKillable() {
+    Process::disable();
+    /* makeReady forgets the queue, whoever woke us may free it */
+    if ((killableQueue != nullptr) && killableQueue->removeValue(this)) {
+        killWoken = true;
+        makeReady();
+    }
+    Process::enable();
+}
+
 signal_action_t Process::getSignalAction(signal_t s){
     switch((signal_action_t)(uint32_t)signalHandlers[s]){
         case EXIT:
@@ -409,7 +532,7 @@ signal_action_t Process::getSignalAction(signal_t s){
 }
 
 long Process::setSignalAction(signal_t sig, signal_action_t act){
-    if(!Signal::validateSignal(sig) && sig < (signal_t)0x80000000){
+    if(!Signal::validateSignal(sig)){
         return ERR_NOT_POSSIBLE;
     }
     if(sig == SIGKILL) { // cannot catch, block, or ignore
@@ -426,6 +549,100 @@ long Process::setSignalAction(signal_t sig, signal_action_t act){
     return 0;
 }
 
+void Process::adopt(Process* child) {
+    Process::disable();
+    child->parent = this;
+    child->nextSibling = children;
+    children = (Process*) Resource::ref(child);
+    Process::enable();
+}
+
+long Process::waitChild(long pid, long* code) {
+    Process::disable();
+    while (true) {
+        bool found = false;
+        for (Process** pp = &children; *pp != nullptr; pp = &(*pp)->nextSibling) {
+            Process* c = *pp;
+            if ((pid != -1) && (c->id != pid)) continue;
+            found = true;
+            if (c->state == TERMINATED) {
+                *pp = c->nextSibling;
+                c->nextSibling = nullptr;
+                c->parent = nullptr;
+                Process::enable();
+
+                long id = c->id;
+                *code = c->exitCode;
+                Resource::unref(c);
+                return id;
+            }
+        }
+        if (!found) {
+            Process::enable();
+            return ERR_NOT_FOUND;
+        }
+        if (!yieldKillable(&childWaiters)) {
+            Process::enable();
+            return ERR_NOT_POSSIBLE;
+        }
+    }
+}
+
+void Process::forgetChild(Process* child) {
+    Process::disable();
+    for (Process** pp = &children; *pp != nullptr; pp = &(*pp)->nextSibling) {
+        if (*pp == child) {
+            *pp = child->nextSibling;
+            child->nextSibling = nullptr;
+            child->parent = nullptr;
+            Process::enable();
+            Resource::unref(child);
+            return;
+        }
+    }
+    Process::enable();
+}
+
+bool Process::takeSignal(signal_t sig) {
+    uint32_t bit = 1u << sig;
+    if ((pendingSignals.get() & bit) == 0) return false;
+    pendingSignals.clearBits(bit);
+
+    if (Signal::isRealTime(sig)) {
+        // A sender bumps the count before it sets the bit, so one that
+        // races with us either leaves the count above 1 (and we put the
+        // bit back) or sets the bit again after we cleared it.
+        Atomic32 &count = rtPending[sig - SIGRTMIN];
+        uint32_t n = count.getThenAdd(-1);
+        if (n == 0) {
+            count.getThenAdd(1);
+            return false;
+        }
+        if (n > 1) {
+            pendingSignals.setBits(bit);
+        }
+    }
+    return true;
+}
+
+uint32_t Process::setSignalMask(long how, uint32_t mask) {
+    uint32_t old = signalMask;
+    // SIGKILL can't be blocked
+    mask &= ~(1 << SIGKILL);
+    switch (how) {
+        case SIG_BLOCK:
+            signalMask |= mask;
+            break;
+        case SIG_UNBLOCK:
+            signalMask &= ~mask;
+            break;
+        case SIG_SETMASK:
+            signalMask = mask;
+            break;
+    }
+    return old;
+}
+
 /*******************/
 /* The timer class */
 /*******************/
@@ -435,35 +652,55 @@ class Timer {
         uint32_t target;
         Timer *next;
         SimpleQueue<Process*> waiting;
+        SimpleQueue<Poller*> pollers;
 };
 
 class Alarm : public Timer {};
 
+/* find or insert the timer for the given jiffy
+   precondition: interrupts are disabled */
+static Timer* timerAt(uint32_t target) {
+    Timer **pp = &Process::timers;
+    Timer* p = Process::timers;
+    while (p) {
+        if (p->target == target) {
+            break;
+        } else if (p->target > target) {
+            p = nullptr;
+            break;
+        } else {
+            pp = &p->next;
+            p = p->next;
+        }
+    }
+    if (!p) {
+        p = new Timer();
+        p->target = target;
+        p->next = *pp;
+        *pp = p;
+    }
+    return p;
+}
+
 void Process::sleepUntil(uint32_t second) {
     Process::disable();
 
     uint32_t target = second * Pit::hz;
     if (target > Pit::jiffies) {
-        Timer **pp = &timers;
-        Timer* p = timers;
-        while (p) {
-            if (p->target == target) {
-                break;
-            } else if (p->target > target) {
-                p = nullptr;
-                break;
-            } else {
-                pp = &p->next;
-                p = p->next;
-            }
-        }
-        if (!p) {
-            p = new Timer();
-            p->target = target;
-            p->next = *pp;
-            *pp = p;
-        }
-        Process::yield(&p->waiting);
+        Process::yieldKillable(&timerAt(target)->waiting);
+    }
+
+    Process::enable();
+}
+
+void Process::wakeAt(uint32_t target, Poller* poller) {
+    Process::disable();
+
+    if (target > Pit::jiffies) {
+        timerAt(target)->pollers.addTail(poller);
+    } else {
+        poller->timeout();
+        Resource::unref(poller);
     }
 
     Process::enable();
@@ -528,6 +765,11 @@ void Process::tick() {
                 Process* p = first->waiting.removeHead();
                 p->makeReady();
             }
+            while (!first->pollers.isEmpty()) {
+                Poller* p = first->pollers.removeHead();
+                p->timeout();
+                Resource::unref(p);
+            }
             delete first;
         }
     }
@@ -10,6 +10,9 @@
 #include "resource.h"
 #include "table.h"
 #include "signal.h"
+#include "trace.h"
+#include "heap.h"
+#include "oom.h"
 
 class Timer;
 class Alarm;
@@ -64,6 +67,9 @@ public:
     // kernel stack for this process
     long *stack;
 
+    // FXSAVE area (see Fpu), nullptr until the first FPU instruction
+    char *fpuState;
+
     // A place for context switching to save the kernel ESP
     long kesp;
 
@@ -73,6 +79,11 @@ public:
     // set to true if the process is killed
     bool isKilled;
 
+    // the queue a killable wait is blocked on, see yieldKillable,
+    // and whether SIGKILL took it off
+    Queue<Process*> *killableQueue;
+    bool killWoken;
+
     // the death message sent by the killer
     long killCode;
     long exitCode;
@@ -100,48 +111,109 @@ public:
     // signalled when the process terminates
     Event doneEvent;
 
-    // Address space for this process
-    AddressSpace addressSpace;
+    // woken when the process terminates
+    PollQueue pollers;
+
+    // Address space for this process, shared with its threads
+    AddressSpace *addressSpace;
+
+    // a vfork child borrows its parent's address space, the parent
+    // waits on this until the child execs or exits
+    Semaphore *vforkDone;
 
     // Parent process
     Process *parent;
 
+    // children that haven't been waited for, linked through
+    // nextSibling, each one holds a reference
+    Process *children;
+    Process *nextSibling;
+
+    // blocked in waitChild
+    SimpleQueue<Process*> childWaiters;
+
+    // chain in the global process table
+    Process *pidNext;
+
+    // make child one of my children
+    void adopt(Process* child);
+
+    // wait for a child to terminate (pid == -1 => any child), returns
+    // its id and stores its exit code, ERR_NOT_FOUND if there is no
+    // such child
+    long waitChild(long pid, long* code);
+
+    // stop tracking a child that was waited for some other way
+    void forgetChild(Process* child);
+
     // Resources
     Table *resources;
 
+    // kernel heap charged to this process
+    Heap::Account *heapAccount;
+
+    // memory limits indexed by Oom::RESIDENT etc, 0 => none.
+    // Children and threads start with their creator's
+    uint32_t memLimits[Oom::LIMITS];
+
     // Signals
     //
     // signalHandlers contains the disposition of each signal
     // If it contains a pointer, the pointer is a handle
     // to the signal handler for that signal
     uint32_t signalHandlers[SIGNUM]; // signal disposition
-    SimpleQueue<Signal*> *signalQueue; // pending signals
-    Mutex *signalMutex; // protects the signal queue
-    bool inSignal;
+    uint32_t signalMask; // blocked signals, one bit per signal
+    Atomic32 pendingSignals; // one bit per signal
+    Atomic32 rtPending[SIGRTNUM]; // sends of each real-time signal
 
     // get and set this process's action for the signal
     virtual signal_action_t getSignalAction(signal_t);
 
+    // is the signal blocked by this process's mask?
+    bool isSignalBlocked(signal_t sig) {
+        return (signalMask & (1u << sig)) != 0;
+    }
+
+    // change the signal mask, returns the old one
+    uint32_t setSignalMask(long how, uint32_t mask);
+
     // returns an error code if not possible
     virtual long setSignalAction(signal_t, signal_action_t);
 
-    // signal this process
+    // signal this process, never blocks so it's safe from interrupts
     void signal(signal_t sig) {
-        signalMutex->lock();
-        // we do not want to receive signals while in this crit. reg.
-        bool wasInSignal = Process::current->inSignal;
-        Process::current->inSignal = true;
+        // count first, see takeSignal
+        if (Signal::isRealTime(sig)) {
+            rtPending[sig - SIGRTMIN].getThenAdd(1);
+        }
+        pendingSignals.setBits(1u << sig);
+        Trace::record(Trace::SIG_ENQUEUE, id, sig);
+        if (sig == SIGKILL) wakeKillable();
+    }
 
-        signalQueue->addTail(new Signal(sig));
-        //Debug::printf("sig %d to %s#%d %X\n", sig, name, id, this);
+    // has it been sent SIGKILL? it exits on the way back to user mode
+    bool isKillPending() {
+        return (pendingSignals.get() & (1u << SIGKILL)) != 0;
+    }
+
+    // take it out of a killable wait so it gets to user mode and dies
+    void wakeKillable();
 
-        Process::current->inSignal = wasInSignal;
-        signalMutex->unlock();
+    // pending signals that aren't blocked
+    uint32_t deliverableSignals() {
+        return pendingSignals.get() & ~signalMask;
     }
 
+    // consume one pending instance of the signal, false if there isn't one
+    bool takeSignal(signal_t sig);
+
     // create a process with an optional name
     // the new process inserts itself in the ready queue
-    Process(const char* name, Table* resources);
+    //
+    // threads pass the table and address space they share,
+    // nullptr => create new ones
+    Process(const char* name, Table* resources,
+        AddressSpace* addressSpace = nullptr);
 
     // destructor
     virtual ~Process();
@@ -170,6 +242,9 @@ public:
     // sleep until the given time
     static void sleepUntil(uint32_t seconds);
 
+    // time out the poller at the given jiffy, consumes a reference
+    static void wakeAt(uint32_t jiffy, Poller* poller);
+
     // sleep for the given number of seconds
     static void sleepFor(uint32_t seconds);
 
@@ -195,6 +270,13 @@ public:
     //    - if no other process is ready, we panic
     static void yield(Queue<Process*> *q);
 
+    // the same for waits that can go on forever (pipes, the console,
+    // children, semaphores...) and that the caller can give up on:
+    // SIGKILL takes the process back off the queue. Call with
+    // interrupts disabled. Returns false if it was killed, before
+    // blocking or while blocked
+    static bool yieldKillable(Queue<Process*> *q);
+
     // called when the current process wants to exit
     //    goes into the terminated state
     static void exit(long code);
@@ -236,6 +318,14 @@ public:
         return nullptr;
     }
 
+    // readable once the process has terminated
+    virtual long poll(long events) {
+        return isTerminated() ? (events & POLLIN) : 0;
+    }
+    virtual PollQueue* pollQueue() {
+        return &pollers;
+    }
+
     // print a trace message with the process identity prefixed to it
     void static vtrace(const char* msg, va_list ap);
     void static trace(const char* msg, ...);
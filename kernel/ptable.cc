@@ -0,0 +1,70 @@
+#include "ptable.h"
+#include "process.h"
+
+static Process* buckets[ProcessTable::BUCKETS];
+
+static inline Process** bucket(long pid) {
+    return &buckets[((uint32_t) pid) % ProcessTable::BUCKETS];
+}
+
+void ProcessTable::add(Process* p) {
+    Process::disable();
+    Process** b = bucket(p->id);
+    p->pidNext = *b;
+    *b = p;
+    Process::enable();
+}
+
+void ProcessTable::remove(Process* p) {
+    Process::disable();
+    for (Process** pp = bucket(p->id); *pp != nullptr; pp = &(*pp)->pidNext) {
+        if (*pp == p) {
+            *pp = p->pidNext;
+            p->pidNext = nullptr;
+            break;
+        }
+    }
+    Process::enable();
+}
+
+Process* ProcessTable::get(long pid) {
+    Process* out = nullptr;
+    Process::disable();
+    for (Process* p = *bucket(pid); p != nullptr; p = p->pidNext) {
+        if (p->id == pid) {
+            /* it can't be deleted while it's in the table */
+            out = (Process*) Resource::ref(p);
+            break;
+        }
+    }
+    Process::enable();
+    return out;
+}
+
+Process* ProcessTable::best(uint32_t (*score)(Process*)) {
+    Process* out = nullptr;
+    uint32_t most = 0;
+    Process::disable();
+    for (uint32_t i = 0; i < BUCKETS; i++) {
+        for (Process* p = buckets[i]; p != nullptr; p = p->pidNext) {
+            uint32_t s = score(p);
+            if (s > most) {
+                most = s;
+                out = p;
+            }
+        }
+    }
+    if (out != nullptr) Resource::ref(out);
+    Process::enable();
+    return out;
+}
+
+void ProcessTable::forEach(void (*f)(Process*, void*), void* arg) {
+    Process::disable();
+    for (uint32_t i = 0; i < BUCKETS; i++) {
+        for (Process* p = buckets[i]; p != nullptr; p = p->pidNext) {
+            f(p,arg);
+        }
+    }
+    Process::enable();
+}
@@ -0,0 +1,35 @@
+#ifndef _PTABLE_H_
+#define _PTABLE_H_
+
+#include "stdint.h"
+
+class Process;
+
+/*
+ * The global process table, maps process ids to live processes.
+ *
+ * A hash on the id with the chains threaded through the processes
+ * themselves, so adding and removing never allocates. A process is in
+ * the table from its creation until it exits; waiting for a dead child
+ * goes through the parent's child list instead.
+ */
+class ProcessTable {
+public:
+    static constexpr uint32_t BUCKETS = 256;
+
+    static void add(Process* p);
+    static void remove(Process* p);
+
+    /* the process with the given id, referenced (the caller must
+       unref it), nullptr if there is none */
+    static Process* get(long pid);
+
+    /* the process with the highest score, referenced, nullptr if none
+       scores above 0. score runs with interrupts disabled */
+    static Process* best(uint32_t (*score)(Process*));
+
+    /* call f on every process with interrupts disabled, it can't block */
+    static void forEach(void (*f)(Process*, void*), void* arg);
+};
+
+#endif
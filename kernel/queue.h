@@ -7,6 +7,8 @@ public:
     virtual T removeHead()= 0;
     virtual bool isEmpty() = 0;
     virtual unsigned long size() = 0;
+    // take v out wherever it is, false if it isn't there
+    virtual bool removeValue(T v) = 0;
 };
 
 template<typename T> class SimpleQueue : public Queue<T> {
@@ -22,7 +24,7 @@ private:
     Node *last;
     unsigned long nodes; // node count (size of queue)
 public:
-    SimpleQueue() : first(0), last(0) {}
+    SimpleQueue() : first(0), last(0), nodes(0) {}
     virtual ~SimpleQueue() {}
     void addTail(T v) {
         Node *n = new Node();
@@ -57,6 +59,18 @@ public:
     unsigned long size() {
         return nodes;
     }
+    bool removeValue(T v) {
+        for (Node *p = first; p != 0; p = p->next) {
+            if (p->value == v) {
+                if (p->prev != 0) p->prev->next = p->next; else first = p->next;
+                if (p->next != 0) p->next->prev = p->prev; else last = p->prev;
+                delete p;
+                nodes--;
+                return true;
+            }
+        }
+        return false;
+    }
 
 };
 
@@ -9,9 +9,15 @@ enum ResourceType {
     SEMAPHORE,
     FILE,
     TABLE,
+    TTY,
+    PIPE,
+    ADDRESS_SPACE,
+    SHM,
     OTHER
 };
 
+class PollQueue;
+
 class Resource {
 public:
     static Resource* ref(Resource* p) {
@@ -47,6 +53,19 @@ public:
     virtual Resource* forkMe() {
         return ref(this);
     }
+
+    /* Readiness for poll. Returns the subset of the given events
+       that are ready right now, and the queue that is woken when
+       that might change (nullptr => never changes).
+
+       Called with interrupts disabled
+     */
+    virtual long poll(long events) {
+        return 0;
+    }
+    virtual PollQueue* pollQueue() {
+        return nullptr;
+    }
 };
 
 typedef Resource *ResourcePtr;
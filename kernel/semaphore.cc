@@ -24,13 +24,31 @@ void Semaphore::down() {
     Process::enable();
 }
 
+bool Semaphore::downKillable() {
+    bool got = true;
+    Process::disable();
+    if (count == 0) {
+        /* up hands the count straight to a waiter it wakes */
+        got = Process::yieldKillable(&waiting);
+    } else {
+        count --;
+    }
+    Process::enable();
+    return got;
+}
+
 void Semaphore::up() {
     Process::disable();
     if (waiting.isEmpty()) {
         count ++;
+        pollers.wakeAll();
     } else {
         Process *p = waiting.removeHead();
         p->makeReady();
     }
     Process::enable();
 }
+
+long Semaphore::poll(long events) {
+    return (count > 0) ? (events & POLLIN) : 0;
+}
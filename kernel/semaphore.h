@@ -3,23 +3,34 @@
 
 #include "queue.h"
 #include "resource.h"
+#include "poll.h"
 
 class Process;
 
 class Semaphore : public Resource {
     int count;
     SimpleQueue<Process*> waiting;
+    PollQueue pollers;
 public:
     Semaphore(int count);
     virtual ~Semaphore();
     void down();
     void up();
+
+    /* down for waits a user can be stuck in, false if the caller was
+       killed instead (see Process::yieldKillable) */
+    bool downKillable();
+
+    /* readable when down would not block */
+    virtual long poll(long events);
+    virtual PollQueue* pollQueue() { return &pollers; }
 };
 
 class Mutex : Semaphore {
 public:
     Mutex() : Semaphore(1) {}
     void lock() { down(); }
+    bool lockKillable() { return downKillable(); }
     void unlock() { up(); }
 };
 
@@ -31,6 +42,11 @@ public:
         status.down();
         status.up();
     }
+    bool waitKillable() {
+        if (!status.downKillable()) return false;
+        status.up();
+        return true;
+    }
     void signal() {
         status.up();
     }
@@ -0,0 +1,42 @@
+#include "shm.h"
+#include "vmm.h"
+#include "process.h"
+
+ShmSegment::ShmSegment(uint32_t bytes) : Resource(ResourceType::SHM) {
+    nPages = (bytes + PhysMem::FRAME_SIZE - 1) / PhysMem::FRAME_SIZE;
+    frames = new uint32_t[nPages]();
+    account = Heap::hold(Heap::payer());
+}
+
+ShmSegment::~ShmSegment() {
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < nPages; i++) {
+        if (frames[i]) {
+            PhysMem::free(frames[i]);
+            n++;
+        }
+    }
+    delete[] frames;
+    if (account != nullptr) {
+        Process::disable();
+        account->frames -= n;
+        Process::enable();
+        Heap::close(account);
+    }
+}
+
+uint32_t ShmSegment::size() {
+    return nPages * PhysMem::FRAME_SIZE;
+}
+
+uint32_t ShmSegment::page(uint32_t n) {
+    if (n >= nPages) return 0;
+    Process::disable();
+    if (frames[n] == 0) {
+        frames[n] = PhysMem::alloc();
+        if (account != nullptr) account->frames ++;
+    }
+    uint32_t frame = frames[n];
+    Process::enable();
+    return frame;
+}
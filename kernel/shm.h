@@ -0,0 +1,34 @@
+#ifndef _SHM_H_
+#define _SHM_H_
+
+#include "resource.h"
+#include "vma.h"
+#include "heap.h"
+
+/*
+ * A shared memory segment: frames that any number of processes can
+ * map with MAP_SHARED. Descriptors (inherited by fork like any other)
+ * and mappings both hold references, the frames go back when the last
+ * of either is gone. Frames are allocated on first touch and charged
+ * to the process that created the segment.
+ */
+class ShmSegment : public Resource, public Pager {
+    uint32_t nPages;
+    uint32_t *frames;
+    /* its frames count against the creator's memory */
+    Heap::Account *account;
+public:
+    /* the biggest segment in bytes */
+    static constexpr uint32_t LIMIT = 16 << 20;
+
+    ShmSegment(uint32_t bytes);
+    virtual ~ShmSegment();
+
+    uint32_t size();
+
+    virtual uint32_t page(uint32_t n);
+    virtual void attach() { Resource::ref(this); }
+    virtual void detach() { Resource::unref(this); }
+};
+
+#endif
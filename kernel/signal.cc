@@ -2,6 +2,7 @@
 #include "process.h"
 #include "machine.h"
 #include "pic.h"
+#include "gdt.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 // modeled on Linux kernel 3.17.1
@@ -25,84 +26,158 @@ struct __attribute__((packed)) jumpercode {
 // used from linux kernel
 #define STACK_ALIGN(esp) ((esp) >> 4 << 4)
 
-sigframe *Signal::getSignalFrame(jumpercode *jumper){
-    sigframe *frame;
-    Process *me = Process::current;
-
-    frame = (sigframe*)STACK_ALIGN(me->context->registers->esp - sizeof(sigframe));
-    frame->returnadr = jumper;
-    frame->context = &frame->registers;
-    frame->registers = *me->context->registers;
-    me->context->frame = frame;
-
-    return frame;
-}
-
-jumpercode *Signal::putJumperCode(){
-    jumpercode *jumper;
-    Process *me = Process::current;
-
-    // get address on stack
-    // put it after the sigframe (arbitrary choice)
-    jumper = (jumpercode*)STACK_ALIGN(me->context->registers->esp
-            - sizeof(sigframe) - sizeof(jumpercode));
+jumpercode *Signal::putJumperCode(uint32_t esp){
+    // one copy above all the frames, they all return to it
+    jumpercode *jumper = (jumpercode*)STACK_ALIGN(esp - sizeof(jumpercode));
     *jumper = jumpercode();
 
     return jumper;
 }
 
-// will run in kernel mode, with interrupts disabled
-void Signal::checkSignals(SimpleQueue<Signal*> *signals) {
+// the most the frames for the handled signals in ready can take
+static uint32_t frameSpace(Process *me, uint32_t ready) {
+    uint32_t handled = 0;
+    for (int sig = 0; sig < SIGNUM; sig++) {
+        if ((ready & (1u << sig)) && (me->getSignalAction((signal_t) sig) == HANDLE)) {
+            handled ++;
+        }
+    }
+    if (handled == 0) return 0;
+    // alignment can take up to 15 bytes below each of them
+    return sizeof(jumpercode) + 15 + handled * (sizeof(sigframe) + 15);
+}
 
-    //Process::trace("checking %s#%d's signal queue %x, %x", Process::current->name, Process::current->id, Process::current->signalQueue, signals);
+// will run in kernel mode with preemption on, the frames are built
+// with it off
+void Signal::checkSignals(regs *resume) {
+    Process *me = Process::current;
+    if (me->deliverableSignals() == 0) return;
+
+    // resume can live on the user stack where the frames go
+    regs next = *resume;
+    uint32_t esp = next.esp;
+
+    // Building the frames can't fault, a page that's swapped out would
+    // block in the middle of it. Their pages are faulted in first and
+    // checked again once nothing else can run.
+    Process::disable();
+    uint32_t ready = me->deliverableSignals();
+    while (ready != 0) {
+        uint32_t room = frameSpace(me, ready);
+        uint32_t low = (esp > room) ? esp - room : 0;
+        if (me->addressSpace->present(low, esp, true)) break;
+        Process::enable();
+        me->addressSpace->prefault(low, esp, true);
+        Process::disable();
+        ready = me->deliverableSignals();
+    }
 
-    if(!signals->isEmpty()){
-        signals->removeHead()->doSignal();
-        Process::current->checkKilled(); // in case a signal killed it
+    uint32_t mask = me->signalMask;
+    jumpercode *jumper = nullptr;
+
+    // The frame pushed last runs first. Going from the highest signal
+    // down means the lowest numbered handler runs first, and each one
+    // returns (through sys_sigret) into the next.
+    while (ready != 0) {
+        signal_t sig = (signal_t) (31 - __builtin_clz(ready));
+        ready &= ~(1u << sig);
+        if (!me->takeSignal(sig)) continue;
+
+        switch (me->getSignalAction(sig)) {
+            case IGNORE:
+                break;
+            case EXIT:
+                // kill the process with the signal code, doesn't return
+                Process::enable();
+                me->kill(sig);
+                return;
+            case HANDLE:
+                {
+                    if (jumper == nullptr) {
+                        jumper = putJumperCode(esp);
+                        esp = (uint32_t) jumper;
+                    }
+                    sigframe *frame = (sigframe*)STACK_ALIGN(esp - sizeof(sigframe));
+                    frame->returnadr = jumper;
+                    frame->context = &frame->registers;
+                    frame->prev = me->context->frame;
+                    frame->mask = mask;
+                    frame->sig = sig;
+                    frame->registers = next;
+                    // the handler can use the FPU, the registers are
+                    // lazily switched so they may only be in the CPU
+                    frame->fpuSaved = Fpu::save(me, frame->fpu);
+                    me->context->frame = frame;
+                    Trace::record(Trace::SIG_FRAME, me->getId(), sig);
+
+                    // the handler runs with its own signal blocked
+                    mask |= 1u << sig;
+                    next.eip = me->signalHandlers[sig];
+                    next.esp = (uint32_t) frame;
+                    esp = (uint32_t) frame;
+                }
+                break;
+            default: // should never happen
+                break;
+        }
     }
-}
 
-// will run in kernel mode, with interrupts disabled
-void Signal::doSignal(){
-    //find out what the action for this signal should be
-    signal_action_t action = Process::current->getSignalAction(sig);
-
-    switch(action) {
-        case IGNORE:
-            // Process::trace("ignore");
-            return;
-        case EXIT:
-            // Process::trace("kill");
-            // kill the process with the signal code
-            // enable interupts
-            Process::current->kill(sig);
-            return;
-        case HANDLE:
-            //Debug::printf("%s#%d %X doing signal %d\n", Process::current->name, Process::current->id, Process::current, sig);
-            // Process::trace("HANDLE");
-            // handle the signal
-            setupFrame();
-            return;
-        default: // should never happen
-            return;
+    if (jumper == nullptr) {
+        Process::enable();
+        return;
     }
-}
 
-void Signal::setupFrame(){
-    // set up jumper code to call sys_sigret
-    jumpercode *jumper = putJumperCode();
+    me->signalMask = mask & ~(1 << SIGKILL);
 
-    // set up stack frame for handler.
-    // we must return to the jumper code
-    sigframe *frame = getSignalFrame(jumper);
+    // we came from user mode and never return to this kernel stack,
+    // the handler runs with interrupts enabled
+    me->iDepth = 0;
+    me->disableCount = 0;
 
-    // enable interupts during the handler
-    Process::current->iDepth --;
-    Process::current->disableCount = 0;
+    switchToUser(next.eip, next.esp, 0);
+}
 
-    // Debug::printf("going to jmp to %x\n", Process::current->signalHandlers[sig]);
+void Signal::sigret() {
+    Process *me = Process::current;
+
+    // the frame is user memory, it's read like checkSignals writes
+    Process::disable();
+    sigframe *frame = me->context->frame;
+    while (((uint32_t) frame >= 0x80000000) &&
+            !me->addressSpace->present((uint32_t) frame, (uint32_t) (frame + 1), false)) {
+        Process::enable();
+        me->addressSpace->prefault((uint32_t) frame, (uint32_t) (frame + 1), false);
+        Process::disable();
+        frame = me->context->frame;
+    }
+    if ((uint32_t) frame < 0x80000000) {
+        // no handler is running, or the frame chain was trashed
+        Process::enable();
+        me->kill(SIGSEGV);
+        return;
+    }
+    Trace::record(Trace::SIG_RETURN, me->getId(), frame->sig);
+    me->context->frame = frame->prev;
+    me->signalMask = frame->mask & ~(1 << SIGKILL);
+    if (frame->fpuSaved) {
+        Fpu::restore(me, frame->fpu);
+    }
 
-    switchToUser((uint32_t)Process::current->signalHandlers[sig], (uint32_t)frame, 0);
+    // the handler may have changed the registers, but not the privilege:
+    // iret would take any selector it left there, a kernel one included
+    regs next = frame->registers;
+    Process::enable();
+    next.flags = (next.flags | (1 << 9)) & ~(3 << 12);
+    next.cs = userCodeSeg;
+    next.ss = userDataSeg;
+    next.ds = userDataSeg;
+
+    // deliver what the restored mask lets through
+    checkSignals(&next);
+
+    Process::disable();
+    me->disableCount = 0;
+    sys_sigret((uint32_t) &next);
 }
 
 signal_action_t Signal::defaultDisposition(signal_t sig) {
@@ -112,7 +187,7 @@ signal_action_t Signal::defaultDisposition(signal_t sig) {
         case SIGSEGV: return EXIT;
         case SIGCHLD: return IGNORE;
         case SIGKILL: return EXIT;
-        default: return NOTFOUND;
+        default: return isRealTime(sig) ? EXIT : NOTFOUND;
     }
 }
 
@@ -123,5 +198,5 @@ void Signal::initHandlers(uint32_t (&handlers)[SIGNUM]) {
 }
 
 bool Signal::validateSignal(signal_t s) {
-    return defaultDisposition(s) != NOTFOUND;
+    return (s >= 0) && (s < SIGNUM) && (defaultDisposition(s) != NOTFOUND);
 }
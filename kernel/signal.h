@@ -1,11 +1,10 @@
 #ifndef _SIGNAL_H_
 #define _SIGNAL_H_
 
-#include "queue.h"
 #include "debug.h"
 #include "atomic.h"
-#include "semaphore.h"
 #include "stdint.h"
+#include "fpu.h"
 
 enum signal_t {
     SIGINT  = 2,
@@ -13,9 +12,21 @@ enum signal_t {
     SIGSEGV = 11,
     SIGKILL = 9,
     SIGCHLD = 17,
+    // real-time signals are counted, every send is delivered
+    SIGRTMIN = 24,
+    SIGRTMAX = 31,
     SIGNUM // ALWAYS the last one, represents the number of signals
 };
 
+#define SIGRTNUM (SIGRTMAX - SIGRTMIN + 1)
+
+// how for setSignalMask, same as Linux
+enum {
+    SIG_BLOCK = 0,
+    SIG_UNBLOCK = 1,
+    SIG_SETMASK = 2
+};
+
 enum signal_action_t {
     IGNORE, // will not trigger the sig handler
     DEFAULT, // Converted to the default
@@ -53,47 +64,57 @@ public:
         esp(0), ss(0) {}
 };
 
+// lives on the user stack, the handler's argument is context
 struct sigframe {
 public:
     jumpercode *returnadr;
     regs *context;
+    sigframe *prev; // the frame of the handler we interrupted
+    uint32_t mask; // restored by sys_sigret
+    uint32_t sig;
     regs registers;
+    uint32_t fpuSaved; // fpu holds the interrupted x87/SSE state
+    char fpu[Fpu::AREA_SIZE] __attribute__((aligned(16)));
 
     sigframe() {}
 };
 
 struct sigcontext {
 public:
-    regs *registers;
-    sigframe *frame;
+    sigframe *frame; // innermost handler frame, nullptr => none
 
-    sigcontext(){
-        registers = new regs();
-    }
-    ~sigcontext(){
-        delete registers;
-    }
+    sigcontext() : frame(nullptr) {}
 };
 
+/*
+ * Pending signals are a bitmask in the receiving process. Sending sets
+ * a bit (and bumps a counter for real-time signals) with atomic
+ * instructions, so it never allocates or blocks and is safe from
+ * interrupt handlers.
+ *
+ * Delivery happens on the way back to user mode: every pending signal
+ * that isn't blocked is taken at once and the handler frames are
+ * stacked so the handlers run back to back.
+ */
 class Signal{
 private:
-    signal_t sig;
-
-    void setupFrame();
-    sigframe *getSignalFrame(jumpercode*);
-    jumpercode *putJumperCode();
+    static jumpercode *putJumperCode(uint32_t esp);
 
 public:
-    Signal(signal_t sig) : sig(sig) {}
+    /* Deliver all pending unblocked signals before returning to the
+       user state in resume. Called with preemption on, it may fault the
+       user stack in. Doesn't return if a handler will run. */
+    static void checkSignals(regs *resume);
+
+    /* Return to the state saved in the innermost handler frame */
+    static void sigret();
 
-    /* Handle all signals in this process signal queue */
-    static void checkSignals(SimpleQueue<Signal*> *signals);
     static signal_action_t defaultDisposition(signal_t);
     static void initHandlers(uint32_t (&handlers)[SIGNUM]);
     static bool validateSignal(signal_t s);
-
-    /* Handle this signal */
-    void doSignal();
+    static bool isRealTime(signal_t s) {
+        return (s >= SIGRTMIN) && (s <= SIGRTMAX);
+    }
 };
 
 #endif
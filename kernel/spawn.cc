@@ -0,0 +1,28 @@
+#include "spawn.h"
+#include "libk.h"
+
+Spawn::Spawn(Process *parent, const char* path,
+        SimpleQueue<const char*> *args, long argc,
+        Resource* in, Resource* out) :
+    Process("spawn",nullptr), path(K::strdup(path)), argc(argc)
+{
+    while (!args->isEmpty()) {
+        this->args.addTail(args->removeHead());
+    }
+    resources->openAt(Table::STDIN, in);
+    resources->openAt(Table::STDOUT, out);
+    signalMask = parent->signalMask;
+    parent->adopt(this);
+}
+
+Spawn::~Spawn() {
+    while (!args.isEmpty()) {
+        delete[] args.removeHead();
+    }
+    delete[] path;
+}
+
+long Spawn::run() {
+    /* only returns if the program can't be loaded */
+    return execv(path,&args,argc);
+}
@@ -0,0 +1,23 @@
+#ifndef _SPAWN_H_
+#define _SPAWN_H_
+
+#include "process.h"
+
+/* A process started straight from a program file. It gets a fresh
+   address space and loads the program itself, so nothing is copied
+   from the parent only to be thrown away by exec */
+class Spawn : public Process {
+    const char* path;
+    SimpleQueue<const char*> args;
+    long argc;
+public:
+    /* takes the strings in args, in and out become its standard
+       input and output */
+    Spawn(Process *parent, const char* path,
+        SimpleQueue<const char*> *args, long argc,
+        Resource* in, Resource* out);
+    virtual ~Spawn();
+    virtual long run();
+};
+
+#endif
@@ -0,0 +1,312 @@
+#include "swap.h"
+#include "zram.h"
+#include "process.h"
+#include "futex.h"
+#include "machine.h"
+#include "debug.h"
+
+IDE* Swap::drive = nullptr;
+Mutex* Swap::mutex = nullptr;
+Swap::Frame* Swap::frames = nullptr;
+uint32_t Swap::nFrames = 0;
+uint32_t Swap::hand = 0;
+uint32_t Swap::coldHand = 0;
+uint32_t Swap::coldBelow = 0;
+uint32_t* Swap::slots = nullptr;
+uint32_t Swap::nSlots = 0;
+uint32_t Swap::usedSlots = 0;
+uint32_t Swap::nextSlot = 1;
+uint32_t Swap::compressedOut = 0;
+uint32_t Swap::idleOut = 0;
+uint32_t Swap::diskOut = 0;
+uint32_t Swap::compressedIn = 0;
+uint32_t Swap::diskIn = 0;
+uint64_t Swap::compressedCycles = 0;
+uint64_t Swap::diskCycles = 0;
+
+/* the label at the start of a swap drive */
+static const char magic[] = "PanicOS swap";
+
+static bool isSwapDrive(IDE* d) {
+    if (d->sectors() < 2 * Swap::SECTORS_PER_SLOT) return false;
+    char sector[IDE::SECTOR_SIZE];
+    d->readBlock(0,sector);
+    for (uint32_t i = 0; magic[i] != 0; i++) {
+        if (sector[i] != magic[i]) return false;
+    }
+    return true;
+}
+
+void Swap::init(IDE* d) {
+    nFrames = PhysMem::limit / PhysMem::FRAME_SIZE;
+    frames = new Frame[nFrames];
+    for (uint32_t i = 0; i < nFrames; i++) {
+        frames[i].owner = nullptr;
+        frames[i].va = 0;
+    }
+    coldBelow = nFrames / 8;
+    if (coldBelow < COLD) coldBelow = COLD;
+    mutex = new Mutex();
+    Zram::init(nFrames);
+
+    if (!isSwapDrive(d)) {
+        Debug::printf("no swap drive\n");
+        return;
+    }
+    uint32_t n = d->sectors() / SECTORS_PER_SLOT;
+    /* the other half of the numbers are Zram handles */
+    if (n > IN_ZRAM) n = IN_ZRAM;
+
+    /* slot 0 means none */
+    nSlots = n;
+    slots = new uint32_t[(n + 31) / 32];
+    for (uint32_t i = 0; i < (n + 31) / 32; i++) slots[i] = 0;
+    slots[0] = 1;
+
+    drive = d;
+    Debug::printf("I have %dMB of swap\n",(n * PhysMem::FRAME_SIZE) >> 20);
+}
+
+void Swap::track(uint32_t frame, AddressSpace* space, uint32_t va) {
+    if (frames == nullptr) return;
+    Process::disable();
+    Frame* f = &frames[frame / PhysMem::FRAME_SIZE];
+    f->owner = space;
+    f->va = va & 0xfffff000;
+    Process::enable();
+}
+
+void Swap::untrack(uint32_t frame) {
+    if (frames == nullptr) return;
+    Process::disable();
+    frames[frame / PhysMem::FRAME_SIZE].owner = nullptr;
+    Process::enable();
+}
+
+/* precondition: disabled */
+uint32_t Swap::allocSlot() {
+    for (uint32_t i = 0; i < nSlots; i++) {
+        uint32_t s = nextSlot;
+        nextSlot = (nextSlot + 1 == nSlots) ? 1 : nextSlot + 1;
+        if ((slots[s / 32] & (1u << (s % 32))) == 0) {
+            slots[s / 32] |= 1u << (s % 32);
+            usedSlots ++;
+            return s;
+        }
+    }
+    return 0;
+}
+
+/* precondition: disabled */
+void Swap::freeSlot(uint32_t s) {
+    slots[s / 32] &= ~(1u << (s % 32));
+    usedSlots --;
+}
+
+void Swap::readSlot(uint32_t slot, uint32_t frame) {
+    char* p = (char*) frame;
+    for (uint32_t i = 0; i < SECTORS_PER_SLOT; i++) {
+        drive->readBlock(slot * SECTORS_PER_SLOT + i, p + i * IDE::SECTOR_SIZE);
+    }
+}
+
+void Swap::writeSlot(uint32_t slot, uint32_t frame) {
+    const char* p = (const char*) frame;
+    for (uint32_t i = 0; i < SECTORS_PER_SLOT; i++) {
+        drive->writeBlock(slot * SECTORS_PER_SLOT + i, p + i * IDE::SECTOR_SIZE);
+    }
+}
+
+uint32_t* Swap::mapping(uint32_t i, AddressSpace** space, uint32_t* va) {
+    if (frames == nullptr) return nullptr;
+    Frame* f = &frames[i];
+    if (f->owner == nullptr) return nullptr;
+    uint32_t* pte = f->owner->pteOf(f->va);
+    uint32_t kind = AddressSpace::P | AddressSpace::CACHED | AddressSpace::COW;
+    if ((pte == nullptr) || ((*pte & kind) != AddressSpace::P) ||
+            ((*pte & 0xfffff000) != i * PhysMem::FRAME_SIZE)) {
+        /* the map is stale */
+        f->owner = nullptr;
+        return nullptr;
+    }
+    *space = f->owner;
+    *va = f->va;
+    return pte;
+}
+
+uint32_t* Swap::victim(uint32_t i) {
+    AddressSpace* space;
+    uint32_t va;
+    uint32_t* pte = mapping(i,&space,&va);
+    if (pte == nullptr) return nullptr;
+    uint32_t frame = i * PhysMem::FRAME_SIZE;
+    if (*pte & AddressSpace::ACCESSED) {
+        /* second chance */
+        *pte &= ~AddressSpace::ACCESSED;
+        invlpg(va);
+        return nullptr;
+    }
+    if (Futex::waitedOn(frame)) return nullptr;
+    return pte;
+}
+
+bool Swap::compress(uint32_t i, uint32_t* pte) {
+    uint32_t handle = Zram::store(i * PhysMem::FRAME_SIZE);
+    if (handle == 0) return false;
+    *pte = ((IN_ZRAM | handle) << 12) | (*pte & (AddressSpace::U | AddressSpace::W)) |
+        AddressSpace::SWAPPED;
+    invlpg(frames[i].va);
+    frames[i].owner->resident.getThenAdd(-1);
+    frames[i].owner = nullptr;
+    return true;
+}
+
+/* precondition: mutex is held */
+bool Swap::evict() {
+    /* two turns of the hand clear every accessed bit it passes */
+    for (uint32_t n = 0; n < 2 * nFrames; n++) {
+        Process::disable();
+        uint32_t i = hand;
+        hand = (hand + 1 == nFrames) ? 0 : hand + 1;
+        uint32_t* pte = victim(i);
+        if (pte == nullptr) {
+            Process::enable();
+            continue;
+        }
+        uint32_t frame = i * PhysMem::FRAME_SIZE;
+        if (compress(i,pte)) {
+            Process::enable();
+            PhysMem::free(frame);
+            compressedOut ++;
+            return true;
+        }
+        uint32_t slot = (drive == nullptr) ? 0 : allocSlot();
+        if (slot == 0) {
+            /* maybe the next one compresses */
+            Process::enable();
+            continue;
+        }
+        /* the owner's next touch faults and waits for us in in() */
+        *pte = (slot << 12) | (*pte & (AddressSpace::U | AddressSpace::W)) |
+            AddressSpace::SWAPPED;
+        invlpg(frames[i].va);
+        frames[i].owner->resident.getThenAdd(-1);
+        frames[i].owner = nullptr;
+        Process::enable();
+
+        writeSlot(slot,frame);
+        PhysMem::free(frame);
+        diskOut ++;
+        return true;
+    }
+    return false;
+}
+
+void Swap::reclaim() {
+    if ((frames == nullptr) || (PhysMem::freeFrames() >= LOW)) return;
+    /* someone counting on nothing changing under them */
+    Process* me = Process::current;
+    if ((me == nullptr) || (me->disableCount != 0)) return;
+
+    mutex->lock();
+    while (PhysMem::freeFrames() < HIGH) {
+        if (!evict()) break;
+    }
+    mutex->unlock();
+}
+
+void Swap::idle() {
+    if ((frames == nullptr) || (PhysMem::freeFrames() >= coldBelow)) return;
+
+    for (uint32_t n = 0; n < IDLE_BATCH; n++) {
+        Process::disable();
+        uint32_t i = coldHand;
+        coldHand = (coldHand + 1 == nFrames) ? 0 : coldHand + 1;
+        uint32_t* pte = victim(i);
+        bool taken = (pte != nullptr) && compress(i,pte);
+        Process::enable();
+        if (taken) {
+            PhysMem::free(i * PhysMem::FRAME_SIZE);
+            idleOut ++;
+        }
+    }
+}
+
+void Swap::in(AddressSpace* space, uint32_t va) {
+    va &= 0xfffff000;
+    uint64_t start = rdtsc();
+    uint32_t frame = PhysMem::alloc();
+    bool done = false;
+
+    uint32_t pte = space->entry(va);
+    if (isSwapped(pte) && ((pte >> 12) & IN_ZRAM)) {
+        /* no I/O, nothing to wait for */
+        Process::disable();
+        pte = space->entry(va);
+        if (isSwapped(pte) && ((pte >> 12) & IN_ZRAM)) {
+            Zram::load((pte >> 12) & ~IN_ZRAM,frame);
+            space->pmap(va,frame,(pte & AddressSpace::U) != 0,
+                (pte & AddressSpace::W) != 0);
+            compressedIn ++;
+            compressedCycles += rdtsc() - start;
+            done = true;
+        }
+        Process::enable();
+        if (!done) PhysMem::free(frame);
+        return;
+    }
+
+    mutex->lock();
+    pte = space->entry(va);
+    if (isSwapped(pte) && !((pte >> 12) & IN_ZRAM)) {
+        readSlot(pte >> 12,frame);
+        Process::disable();
+        /* unless it was unmapped while we were reading */
+        if (space->entry(va) == pte) {
+            space->pmap(va,frame,(pte & AddressSpace::U) != 0,
+                (pte & AddressSpace::W) != 0);
+            freeSlot(pte >> 12);
+            diskIn ++;
+            diskCycles += rdtsc() - start;
+            done = true;
+        }
+        Process::enable();
+    }
+    mutex->unlock();
+
+    if (!done) PhysMem::free(frame);
+}
+
+void Swap::discard(uint32_t pte) {
+    uint32_t where = pte >> 12;
+    if (where & IN_ZRAM) {
+        Zram::free(where & ~IN_ZRAM);
+        return;
+    }
+    Process::disable();
+    freeSlot(where);
+    Process::enable();
+}
+
+/* there's no 64 bit division in the kernel, lose some bits instead */
+static uint32_t average(uint64_t total, uint32_t n) {
+    while ((total >> 32) != 0) {
+        total >>= 1;
+        n >>= 1;
+    }
+    return (n == 0) ? 0 : ((uint32_t) total) / n;
+}
+
+void Swap::report() {
+    if (frames == nullptr) return;
+    Zram::report();
+    Debug::printf("swap: %d pages compressed (%d by the idle process), %d written to the drive\n",
+        compressedOut + idleOut,idleOut,diskOut);
+    Debug::printf("swap: %d compressed faults, %d cycles each\n",compressedIn,
+        average(compressedCycles,compressedIn));
+    Debug::printf("swap: %d drive faults, %d cycles each\n",diskIn,
+        average(diskCycles,diskIn));
+    if (drive != nullptr) {
+        Debug::printf("swap: %d of %d slots in use\n",usedSlots,nSlots - 1);
+    }
+}
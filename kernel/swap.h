@@ -0,0 +1,145 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+#include "stdint.h"
+#include "ide.h"
+#include "semaphore.h"
+#include "vmm.h"
+
+/*
+ * Paging anonymous memory out, to compressed memory (see Zram) first
+ * and to a swap drive when a page doesn't compress.
+ *
+ * A reverse map says which address space and page every private user
+ * frame is mapped at. When free frames run low, a CLOCK hand sweeps
+ * that map: a page that was accessed since the last pass gets its
+ * accessed bit cleared and a second chance, the first one that wasn't
+ * is compressed or written to a free slot on the drive and its frame
+ * freed. The page table entry keeps where it went in the frame bits
+ * (with the SWAPPED bit and without P), and the next fault on it
+ * brings it back.
+ *
+ * When memory is merely getting tight, the idle process runs a second
+ * hand that compresses the pages that stay cold, so there is room
+ * before anyone has to wait for the drive.
+ *
+ * The drive is a raw IDE disk whose first sector starts with "PanicOS
+ * swap", so nothing else gets paged over by mistake. One slot is 8
+ * sectors, slot 0 (the one with the label) is never used. Frames that
+ * belong to a pager (the page cache, shared memory, the zero page),
+ * page tables, and kernel memory are never swapped.
+ *
+ * Reclaiming happens at points where the faulting process can block:
+ * before a page fault is handled and while fork copies pages, never
+ * inside PhysMem::alloc, whose callers may be holding on to frames.
+ */
+class Swap {
+public:
+    /* reclaim when fewer frames than this are free, up to HIGH */
+    static constexpr uint32_t LOW = 64;
+    static constexpr uint32_t HIGH = 128;
+
+    static constexpr uint32_t SECTORS_PER_SLOT =
+        PhysMem::FRAME_SIZE / IDE::SECTOR_SIZE;
+
+    /* the idle process compresses cold pages with fewer free frames
+       than this (or an eighth of memory), this many frames a tick */
+    static constexpr uint32_t COLD = 2 * HIGH;
+    static constexpr uint32_t IDLE_BATCH = 64;
+
+    /* where a swapped entry's page is: bit 19 of the frame bits set
+       means a Zram handle, clear means a slot on the drive */
+    static constexpr uint32_t IN_ZRAM = 1 << 19;
+
+    /* build the reverse map, swap to the drive if it's a swap drive */
+    static void init(IDE* drive);
+
+    /* the frame is mapped at va in space */
+    static void track(uint32_t frame, AddressSpace* space, uint32_t va);
+
+    /* the frame is no longer mapped */
+    static void untrack(uint32_t frame);
+
+    /* how many frames the reverse map covers */
+    static uint32_t frameCount() { return nFrames; }
+
+    /* precondition: disabled. The entry that maps the i'th frame as a
+       private page, and where, nullptr if it isn't one */
+    static uint32_t* mapping(uint32_t i, AddressSpace** space, uint32_t* va);
+
+    /* make room if memory is tight, may block */
+    static void reclaim();
+
+    /* compress some cold pages if memory is getting tight, called by
+       the idle process, never blocks */
+    static void idle();
+
+    /* a swapped out entry */
+    static bool isSwapped(uint32_t pte) {
+        return (pte & (AddressSpace::SWAPPED | AddressSpace::P)) ==
+            AddressSpace::SWAPPED;
+    }
+
+    /* bring the page at va back, blocks only the caller */
+    static void in(AddressSpace* space, uint32_t va);
+
+    /* the page of a swapped entry is gone */
+    static void discard(uint32_t pte);
+
+    /* print the counters */
+    static void report();
+
+private:
+    struct Frame {
+        AddressSpace* owner;
+        uint32_t va;
+    };
+
+    /* nullptr if there is no swap drive */
+    static IDE* drive;
+    /* serializes the I/O, and the hand */
+    static Mutex* mutex;
+
+    /* the reverse map, one entry per physical frame */
+    static Frame* frames;
+    static uint32_t nFrames;
+    static uint32_t hand;
+    static uint32_t coldHand;
+    static uint32_t coldBelow;
+
+    /* one bit per slot, set while it holds a page */
+    static uint32_t* slots;
+    static uint32_t nSlots;
+    static uint32_t usedSlots;
+    static uint32_t nextSlot;
+
+    /* counters, fault latency in cycles */
+    static uint32_t compressedOut;
+    static uint32_t idleOut;
+    static uint32_t diskOut;
+    static uint32_t compressedIn;
+    static uint32_t diskIn;
+    static uint64_t compressedCycles;
+    static uint64_t diskCycles;
+
+    /* 0 if the drive is full */
+    static uint32_t allocSlot();
+    static void freeSlot(uint32_t slot);
+
+    static void readSlot(uint32_t slot, uint32_t frame);
+    static void writeSlot(uint32_t slot, uint32_t frame);
+
+    /* precondition: disabled. The entry of the i'th frame if it can
+       be taken now, nullptr if not. Accessed pages get their second
+       chance here */
+    static uint32_t* victim(uint32_t i);
+
+    /* precondition: disabled. Compress the frame and point the entry
+       at it, false if it doesn't compress */
+    static bool compress(uint32_t i, uint32_t* pte);
+
+    /* page out one frame, false if there is nothing to take */
+    static bool evict();
+};
+
+#endif
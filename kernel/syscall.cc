@@ -3,17 +3,64 @@
 #include "idt.h"
 #include "process.h"
 #include "child.h"
+#include "thread.h"
 #include "fs.h"
 #include "err.h"
 #include "u8250.h"
 #include "libk.h"
 #include "pic.h"
+#include "tty.h"
+#include "pipe.h"
+#include "futex.h"
+#include "trace.h"
+#include "ptable.h"
+#include "kstack.h"
+#include "spawn.h"
+#include "shm.h"
+#include "swap.h"
+#include "oom.h"
+#include "merge.h"
 
 void Syscall::init(void) {
     IDT::addTrapHandler(100,(uint32_t)syscallTrap,3);
 }
 
-extern "C" long syscallHandler(uint32_t* context, long num, long a0, long a1) {
+/* the user registers saved by syscallTrap */
+static void userRegisters(uint32_t* context, regs* user) {
+    user->ds = context[7];
+    user->ebp = context[6];
+    user->edi = context[5];
+    user->esi = context[4];
+    user->ebx = context[3];
+    user->ecx = context[1];
+    user->edx = context[2];
+    user->eip = context[8];
+    user->cs = context[9];
+    user->flags = context[10];
+    user->esp = context[11];
+    user->ss = context[12];
+}
+
+/* copy a null terminated array of user strings, returns how many */
+static long copyArgs(char** userArgs, SimpleQueue<const char*> *args) {
+    long i = 0;
+    while(true) {
+        char* s = K::strdup(userArgs[i]);
+        if (s == 0) break;
+        args->addTail(s);
+        i++;
+    }
+    return i;
+}
+
+static void freeArgs(SimpleQueue<const char*> *args) {
+    while (!args->isEmpty()) {
+        const char* s = args->removeHead();
+        delete[] s;
+    }
+}
+
+static long doSyscall(uint32_t* context, long num, long a0, long a1) {
 
     switch (num) {
         case 0: /* exit */
@@ -29,6 +76,12 @@ extern "C" long syscallHandler(uint32_t* context, long num, long a0, long a1) {
                 uint32_t userPC = context[8];
                 uint32_t userESP = context[11];
                 Child *child = new Child(Process::current);
+                if (!Process::current->addressSpace->fork(child->addressSpace)) {
+                    /* out of memory, it never runs */
+                    Process::current->forgetChild(child);
+                    Resource::unref(child);
+                    return ERR_NOT_POSSIBLE;
+                }
                 child->pc = userPC;
                 child->esp = userESP;
                 child->eax = 0;
@@ -47,7 +100,8 @@ extern "C" long syscallHandler(uint32_t* context, long num, long a0, long a1) {
                 Semaphore* s = (Semaphore*) Process::current->resources->get(
                         a0,ResourceType::SEMAPHORE);
                 if (s == nullptr) return ERR_INVALID_ID;
-                s->down();
+                /* killed, it never sees the error */
+                if (!s->downKillable()) return ERR_NOT_POSSIBLE;
                 return 0;
             }
         case 5 : /* up */
@@ -63,13 +117,20 @@ extern "C" long syscallHandler(uint32_t* context, long num, long a0, long a1) {
                 Process *proc = (Process*) Process::current->resources->get(a0,
                         ResourceType::PROCESS);
                 if (proc == nullptr) return ERR_INVALID_ID;
-                proc->doneEvent.wait();
+                if (!proc->doneEvent.waitKillable()) return ERR_NOT_POSSIBLE;
                 long code = proc->exitCode;
+                // no need to keep it around for waitpid
+                Process::current->forgetChild(proc);
                 Process::current->resources->close(a0);
                 return code;
             }
         case 7 : /* shutdown */
             {
+                KernelStack::report();
+                AddressSpace::report();
+                Swap::report();
+                Merge::report();
+                Oom::report();
                 Debug::shutdown("");
                 return 0;
             }
@@ -81,6 +142,10 @@ extern "C" long syscallHandler(uint32_t* context, long num, long a0, long a1) {
             }
         case 9 : /* getlen */
             {
+                ShmSegment* s = (ShmSegment*) Process::current->resources->get(a0,ResourceType::SHM);
+                if (s != nullptr) {
+                    return s->size();
+                }
                 File* f = (File*) Process::current->resources->get(a0,ResourceType::FILE);
                 if (f == nullptr) {
                     return ERR_INVALID_ID;
@@ -90,13 +155,21 @@ extern "C" long syscallHandler(uint32_t* context, long num, long a0, long a1) {
         case 10: /* read */
             {
                 long *args = (long*) a0;
-                File* f = (File*) Process::current->resources->get(args[0],ResourceType::FILE);
-                if (f == nullptr) {
-                    return ERR_INVALID_ID;
-                }
                 void* buf = (void*) args[1];
                 long len = (long) args[2];
-                return f->read(buf,len);
+                File* f = (File*) Process::current->resources->get(args[0],ResourceType::FILE);
+                if (f != nullptr) {
+                    return f->read(buf,len);
+                }
+                Tty* t = (Tty*) Process::current->resources->get(args[0],ResourceType::TTY);
+                if (t != nullptr) {
+                    return t->read(buf,len);
+                }
+                Pipe* p = (Pipe*) Process::current->resources->get(args[0],ResourceType::PIPE);
+                if (p != nullptr) {
+                    return p->read(buf,len);
+                }
+                return ERR_INVALID_ID;
             }
         case 11 : /* seek */
             {
@@ -118,28 +191,19 @@ extern "C" long syscallHandler(uint32_t* context, long num, long a0, long a1) {
                 char** userArgs = (char**) a1;
 
                 SimpleQueue<const char*> args;
-
-                int i = 0;
-
-                while(true) {
-                    char* s = K::strdup(userArgs[i]);
-                    if (s == 0) break;
-                    args.addTail(s);
-                    i++;
-                }
+                long i = copyArgs(userArgs,&args);
 
                 long rc = Process::current->execv(name,&args,i);
 
                 /* execv failed, cleanup */
-                while (!args.isEmpty()) {
-                    const char* s = args.removeHead();
-                    delete[] s;
-                }
+                freeArgs(&args);
                 return rc;
             }
         case 14: /* getchar */
             {
-                return U8250::it->get();
+                char ch;
+                if (Tty::console->read(&ch,1) <= 0) return -1;
+                return ch;
             }
         case 15: /* kill */
             {
@@ -147,6 +211,7 @@ extern "C" long syscallHandler(uint32_t* context, long num, long a0, long a1) {
                 Process *proc = (Process*) Process::current->resources->get(a0,
                         ResourceType::PROCESS);
                 if (proc == nullptr) return ERR_INVALID_ID;
+                if (!Signal::validateSignal((signal_t)a1)) return ERR_NOT_POSSIBLE;
                 //Process::trace("sending signal %d to %s %d", a1, proc->name, proc->id);
                 proc->signal((signal_t)a1);
                 //Process::trace("done");
@@ -164,25 +229,220 @@ extern "C" long syscallHandler(uint32_t* context, long num, long a0, long a1) {
             }
         case 18: /* mmap */
             {
-                if((uint32_t)a0 < 0x400000 || (uint32_t)a0 >= 0x80000000){
-                    return ERR_NOT_POSSIBLE;
+                long *args = (long*) a0;
+                uint32_t prot = args[2];
+                uint32_t flags = args[3];
+                if (flags & VMA::ANONYMOUS) {
+                    return Process::current->addressSpace->mmap(args[0],args[1],prot,flags);
+                }
+
+                Resource* res = Process::current->resources->get(args[4]);
+                if (res == nullptr) return ERR_INVALID_ID;
+                Pager* pager = nullptr;
+                if (res->type == ResourceType::FILE) {
+                    pager = ((File*) res)->pager();
+                    /* the files are read only, only private copies can be written */
+                    if ((prot & VMA::WRITE) && !(flags & VMA::PRIVATE)) return ERR_NOT_POSSIBLE;
+                } else if (res->type == ResourceType::SHM) {
+                    pager = (ShmSegment*) res;
                 }
-                return Process::current->addressSpace.mmap((uint32_t)a0 >> 12 << 12);
+                uint32_t offset = args[5];
+                if ((pager == nullptr) || ((offset & 0xfff) != 0)) return ERR_NOT_POSSIBLE;
+                return Process::current->addressSpace->mmap(args[0],args[1],prot,flags,pager,offset);
             }
-        case 0xff: /* sys_sigret */
+        case 19: /* ioctl */
             {
-                // interrupts are disabled
-                //Process::trace("sys_sigret");
+                long *args = (long*) a0;
+                Tty* t = (Tty*) Process::current->resources->get(args[0],ResourceType::TTY);
+                if (t == nullptr) return ERR_INVALID_ID;
+                return t->ioctl(args[1],args[2]);
+            }
+        case 20: /* pipe */
+            {
+                long *fds = (long*) a0;
+                PipeBuffer *buffer = new PipeBuffer();
+                Pipe *in = new Pipe(buffer,false);
+                Pipe *out = new Pipe(buffer,true);
+                long rd = Process::current->resources->open(in);
+                long wr = Process::current->resources->open(out);
+                if ((rd < 0) || (wr < 0)) {
+                    if (rd >= 0) Process::current->resources->close(rd);
+                    else delete in;
+                    if (wr >= 0) Process::current->resources->close(wr);
+                    else delete out;
+                    return ERR_NO_ID;
+                }
+                fds[0] = rd;
+                fds[1] = wr;
+                return 0;
+            }
+        case 21: /* write */
+            {
+                long *args = (long*) a0;
+                const void* buf = (const void*) args[1];
+                long len = (long) args[2];
+                Tty* t = (Tty*) Process::current->resources->get(args[0],ResourceType::TTY);
+                if (t != nullptr) {
+                    return t->write(buf,len);
+                }
+                Pipe* p = (Pipe*) Process::current->resources->get(args[0],ResourceType::PIPE);
+                if (p != nullptr) {
+                    return p->write(buf,len);
+                }
+                return ERR_INVALID_ID;
+            }
+        case 22: /* dup2 */
+            {
+                Resource* res = Process::current->resources->get(a0);
+                if (res == nullptr) return ERR_INVALID_ID;
+                /* process descriptors can't be shared */
+                if (res->type == ResourceType::PROCESS) return ERR_NOT_POSSIBLE;
+                if (a0 == a1) return a1;
+                return Process::current->resources->openAt(a1,res);
+            }
+        case 23: /* poll */
+            {
+                long *args = (long*) a0;
+                return Poller::poll(Process::current->resources,
+                    (pollfd*) args[0], args[1], args[2]);
+            }
+        case 24: /* futex_wait */
+            {
+                return Futex::wait((uint32_t)a0,(uint32_t)a1);
+            }
+        case 25: /* futex_wake */
+            {
+                return Futex::wake((uint32_t)a0,a1);
+            }
+        case 26: /* thread */
+            {
+                Thread *thread = new Thread(Process::current,a0,a1);
+                long id = Process::current->resources->open(thread);
+                thread->start();
 
-                //Debug::printf("uesp=%X\n", Process::current->context->frame->registers.esp);
-                //Debug::printf("upc=%X\n", Process::current->context->frame->registers.eip);
+                return id;
+            }
+        case 27: /* sigprocmask */
+            {
+                if ((a0 < SIG_BLOCK) || (a0 > SIG_SETMASK)) return ERR_NOT_POSSIBLE;
+                return Process::current->setSignalMask(a0,a1);
+            }
+        case 28: /* trace */
+            {
+                return Trace::enable(a0 != 0);
+            }
+        case 29: /* traceread */
+            {
+                if (a1 < 0) return ERR_NOT_POSSIBLE;
+                return Trace::read((TraceEvent*) a0, a1);
+            }
+        case 30: /* getpid */
+            {
+                return Process::current->id;
+            }
+        case 31: /* pidof */
+            {
+                Process *proc = (Process*) Process::current->resources->get(a0,
+                        ResourceType::PROCESS);
+                if (proc == nullptr) return ERR_INVALID_ID;
+                return proc->id;
+            }
+        case 32: /* killpid */
+            {
+                if (!Signal::validateSignal((signal_t)a1)) return ERR_NOT_POSSIBLE;
+                Process *proc = ProcessTable::get(a0);
+                if (proc == nullptr) return ERR_NOT_FOUND;
+                proc->signal((signal_t)a1);
+                Resource::unref(proc);
+                return 0;
+            }
+        case 33: /* waitpid */
+            {
+                long code;
+                long id = Process::current->waitChild(a0,&code);
+                if ((id >= 0) && (a1 != 0)) {
+                    *((long*) a1) = code;
+                }
+                return id;
+            }
+        case 34: /* vfork */
+            {
+                /* a0 is the return address, the stub popped it so the
+                   child can't clobber it on the shared stack */
+                Child *child = new Child(Process::current,true);
+                userRegisters(context,&child->registers);
+                child->registers.eip = a0;
+                child->registers.eax = 0;
 
-                // NOTE: DO NOT USE Process::current->context->registers, because they are stale!!
+                Semaphore done(0);
+                child->vforkDone = &done;
+                long id = Process::current->resources->open(child);
+                child->start();
 
-                Process::current->inSignal = false;
-                sys_sigret((uint32_t)&(Process::current->context->frame->registers));
+                /* the child is using our memory until it execs or exits */
+                done.down();
+                context[8] = a0;
+                return id;
+            }
+        case 35: /* spawn */
+            {
+                long *args = (long*) a0;
+                char* name = (char*) args[0];
+                char** userArgs = (char**) args[1];
+                Resource* in = Process::current->resources->get(args[2]);
+                Resource* out = Process::current->resources->get(args[3]);
+                if ((in == nullptr) || (out == nullptr)) return ERR_INVALID_ID;
+                if ((in->type == ResourceType::PROCESS) ||
+                        (out->type == ResourceType::PROCESS)) {
+                    return ERR_NOT_POSSIBLE;
+                }
+                /* fail here rather than in the child, the file is opened
+                   again by exec */
+                File* prog = FileSystem::rootfs->rootdir->lookupFile(name);
+                if (prog == nullptr) return ERR_NOT_FOUND;
+                Resource::unref(Resource::ref(prog));
 
-                Debug::panic("What?");
+                SimpleQueue<const char*> argList;
+                long argc = copyArgs(userArgs,&argList);
+                Spawn *child = new Spawn(Process::current,name,&argList,argc,in,out);
+                long id = Process::current->resources->open(child);
+                child->start();
+                return id;
+            }
+        case 36: /* brk */
+            {
+                return Process::current->addressSpace->brk((uint32_t)a0);
+            }
+        case 37: /* munmap */
+            {
+                return Process::current->addressSpace->munmap(a0,a1);
+            }
+        case 38: /* mprotect */
+            {
+                long *args = (long*) a0;
+                return Process::current->addressSpace->mprotect(args[0],args[1],args[2]);
+            }
+        case 39: /* shm */
+            {
+                if ((a0 <= 0) || ((uint32_t) a0 > ShmSegment::LIMIT)) return ERR_NOT_POSSIBLE;
+                ShmSegment* segment = new ShmSegment(a0);
+                long id = Process::current->resources->open(segment);
+                if (id < 0) delete segment;
+                return id;
+            }
+        case 40: /* memstat */
+            {
+                return Oom::stats(a0,(MemStats*) a1);
+            }
+        case 41: /* memlimit */
+            {
+                long *args = (long*) a0;
+                return Oom::limit(args[0],args[1],args[2]);
+            }
+        case 0xff: /* sys_sigret */
+            {
+                //Process::trace("sys_sigret");
+                Signal::sigret();
                 return -1;
             }
         default:
@@ -190,3 +450,20 @@ extern "C" long syscallHandler(uint32_t* context, long num, long a0, long a1) {
             return -1;
     }
 }
+
+extern "C" long syscallHandler(uint32_t* context, long num, long a0, long a1) {
+    // over its limits, or memory is running out
+    Oom::check();
+    long rc = doSyscall(context,num,a0,a1);
+
+    // signals that came in during the call go out on the way back
+    Process* me = Process::current;
+    if (me->deliverableSignals() != 0) {
+        regs user;
+        userRegisters(context,&user);
+        user.eax = rc;
+
+        Signal::checkSignals(&user);
+    }
+    return rc;
+}
@@ -1,77 +1,160 @@
 #include "resource.h"
 #include "err.h"
 #include "process.h"
+#include "machine.h"
+
+static inline long roundUp(long n) {
+    return (n + 31) & ~31;
+}
+
+Table::Slots::Slots(long n) : n(n), array(new ResourcePtr[n]()),
+    used(new uint32_t[n / 32]()), older(nullptr)
+{
+}
+
+Table::Slots::~Slots() {
+    delete []array;
+    delete []used;
+    delete older;
+}
 
 Table::Table(long n) : Resource(ResourceType::TABLE),
-    n(n), array(new ResourcePtr[n]())
+    slots(new Slots(roundUp((n < 32) ? 32 : n)))
 {
 }
 
 Table::~Table() {
-    for (long i=0; i<n; i++) {
-        Resource::unref(array[i]);
-        array[i] = nullptr;
+    closeAll();
+    delete slots;
+    slots = nullptr;
+}
+
+bool Table::grow(long i) {
+    Slots* s = slots;
+    if (i < s->n) return true;
+    if (i >= LIMIT) return false;
+
+    long n = s->n * 2;
+    if (n <= i) n = roundUp(i + 1);
+    if (n > LIMIT) n = LIMIT;
+
+    Slots* bigger = new Slots(n);
+    memcpy(bigger->array, s->array, s->n * sizeof(ResourcePtr));
+    memcpy(bigger->used, s->used, (s->n / 32) * sizeof(uint32_t));
+    bigger->older = s;
+    slots = bigger;
+    return true;
+}
+
+long Table::findFree(long first) {
+    Slots* s = slots;
+    long words = s->n / 32;
+    for (long w = first / 32; w < words; w++) {
+        uint32_t bits = s->used[w];
+        if (w == first / 32) {
+            // pretend the ones below first are taken
+            bits |= (1u << (first % 32)) - 1;
+        }
+        if (bits != 0xffffffff) {
+            return w * 32 + __builtin_ctz(~bits);
+        }
     }
-    delete []array;
-    array = nullptr;
+    long i = (first > s->n) ? first : s->n;
+    return grow(i) ? i : ERR_NO_ID;
 }
 
 long Table::open(Resource* p) {
-    long i;
-    mutex.lock();
-    for (i=1; i<n; i++) {
-        if (array[i] == nullptr) {
-            array[i] = Resource::ref(p);
-            goto done;
-        }
+    Resource::ref(p);
+    Process::disable();
+    long i = findFree(RESERVED);
+    if (i >= 0) {
+        Slots* s = slots;
+        s->array[i] = p;
+        s->used[i / 32] |= 1u << (i % 32);
     }
-    i = ERR_NO_ID;
-done:
-    mutex.unlock();
+    Process::enable();
+    if (i < 0) Resource::unref(p);
+    return i;
+}
+
+long Table::openAt(long i, Resource* p) {
+    if (i < 0) return ERR_INVALID_ID;
+    Resource* old = nullptr;
+    Resource::ref(p);
+    Process::disable();
+    if (!grow(i)) {
+        Process::enable();
+        Resource::unref(p);
+        return ERR_INVALID_ID;
+    }
+    Slots* s = slots;
+    old = s->array[i];
+    s->array[i] = p;
+    s->used[i / 32] |= 1u << (i % 32);
+    Process::enable();
+    Resource::unref(old);
     return i;
 }
 
 long Table::close(long i) {
     if (i < 0) return ERR_INVALID_ID;
-    if (i >= n) return ERR_INVALID_ID;
-    mutex.lock();
-    Resource* old = array[i];
+    Resource* old = nullptr;
+    Process::disable();
+    Slots* s = slots;
+    if (i < s->n) {
+        old = s->array[i];
+        s->array[i] = nullptr;
+        s->used[i / 32] &= ~(1u << (i % 32));
+    }
+    Process::enable();
+    // the last reference can take a while to go away, do it outside
     Resource::unref(old);
-    array[i] = nullptr;
-    mutex.unlock();
     return (old == nullptr) ? ERR_INVALID_ID : 0;
 }
 
-void Table::closeAll() {
-    mutex.lock();
-    for (int i=0; i<n; i++) {
-        // we do not want the child to signal us
-        if(array[i] && array[i]->type == PROCESS){
-            ((Process*)array[i])->parent = nullptr;
+void Table::closeAll(long first) {
+    long words = slots->n / 32;
+    for (long w = first / 32; w < words; w++) {
+        uint32_t bits = slots->used[w];
+        while (bits != 0) {
+            long i = w * 32 + __builtin_ctz(bits);
+            bits &= bits - 1;
+            if (i >= first) close(i);
         }
-        Resource::unref(array[i]);
-        array[i] = nullptr;
     }
-    mutex.unlock();
 }
 
-
 Table* Table::forkMe() {
-    Table* tp = new Table(n);
-    for (long i=0; i<n; i++) {
-        if (this->array[i]) {
-            tp->array[i] = this->array[i]->forkMe();
-        } else {
-            tp->array[i] = nullptr;
+    Slots* s = slots;
+    Table* tp = new Table(s->n);
+    Slots* t = tp->slots;
+    for (long w = 0; w < s->n / 32; w++) {
+        uint32_t bits = s->used[w];
+        while (bits != 0) {
+            long i = w * 32 + __builtin_ctz(bits);
+            bits &= bits - 1;
+            Resource* r = s->array[i];
+            Resource* copy = r ? r->forkMe() : nullptr;
+            if (copy) {
+                t->array[i] = copy;
+                t->used[w] |= 1u << (i % 32);
+            }
         }
     }
     return tp;
 }
 
 Resource* Table::get(long fd, ResourceType type) {
-    if (fd < 0) return nullptr;
-    if (fd >= n) return nullptr;
-    Resource* res = array[fd];
+    Resource* res = get(fd);
+    if (res == nullptr) return nullptr;
     if (res->type != type) return nullptr;
     return res;
 }
+
+Resource* Table::get(long fd) {
+    // no lock, a grow publishes a complete copy
+    Slots* s = slots;
+    if (fd < 0) return nullptr;
+    if (fd >= s->n) return nullptr;
+    return s->array[fd];
+}
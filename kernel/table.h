@@ -1,18 +1,58 @@
 #ifndef _TABLE_H_
 #define _TABLE_H_
 
+class Process;
+
 class Table : public virtual Resource {
-    long n;
-    ResourcePtr *array;
-    Mutex mutex;
+    // One generation of the descriptors. Growing the table builds a
+    // bigger one and switches to it, so get never needs a lock. Old
+    // generations are kept until the table goes away because a reader
+    // may still be looking at one.
+    struct Slots {
+        long n;                 // a multiple of 32
+        ResourcePtr *array;
+        uint32_t *used;         // bit i set => descriptor i is open
+        Slots *older;
+
+        Slots(long n);
+        ~Slots();
+    };
+
+    Slots * volatile slots;
+
+    // lowest free descriptor >= first, growing the table if needed
+    // called with interrupts disabled
+    long findFree(long first);
+    // make room for descriptor i, false if it's too big
+    bool grow(long i);
 public:
-    Table(long n);
+    // standard input and output, both start out as the console.
+    // The reserved descriptors are never handed out by open and
+    // they survive exec
+    static constexpr long STDIN = 0;
+    static constexpr long STDOUT = 1;
+    static constexpr long RESERVED = 2;
+
+    // initial size and the most the table will grow to
+    static constexpr long INITIAL = 32;
+    static constexpr long LIMIT = 4096;
+
+    // processes running with this table, the threads of a process
+    // share it and the last one to exit closes it
+    Atomic32 users;
+
+    Table(long n = INITIAL);
     virtual ~Table();
 
+    // install p at the lowest free descriptor
     long open(Resource* p);
+    // install p at descriptor i, closing whatever was there
+    long openAt(long i, Resource* p);
     long close(long i);
-    void closeAll();
+    // close descriptors first .. n-1
+    void closeAll(long first = 0);
     Resource* get(long id, ResourceType type);
+    Resource* get(long id);
     Table* forkMe();
 };
 
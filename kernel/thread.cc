@@ -0,0 +1,20 @@
+#include "thread.h"
+#include "machine.h"
+#include "err.h"
+#include "fpu.h"
+
+Thread::Thread(Process *creator, uint32_t pc, uint32_t esp) :
+    Process("thread",creator->resources,creator->addressSpace),
+    esp(esp), pc(pc)
+{
+    signalMask = creator->signalMask;
+    for (int i = 0; i < SIGNUM; i++) {
+        signalHandlers[i] = creator->signalHandlers[i];
+    }
+    Fpu::fork(creator,this);
+}
+
+long Thread::run() {
+    switchToUser(pc,esp,0);
+    return ERR_NOT_POSSIBLE;
+}
@@ -0,0 +1,16 @@
+#ifndef _THREAD_H_
+#define _THREAD_H_
+
+#include "process.h"
+
+/* A thread shares its creator's address space and resource table,
+   it has its own kernel stack, user stack, and signal mask */
+class Thread : public Process {
+public:
+    uint32_t esp;
+    uint32_t pc;
+    Thread(Process *creator, uint32_t pc, uint32_t esp);
+    virtual long run();
+};
+
+#endif
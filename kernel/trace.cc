@@ -0,0 +1,53 @@
+#include "trace.h"
+#include "process.h"
+#include "machine.h"
+
+bool Trace::enabled = false;
+
+static TraceEvent ring[Trace::SIZE];
+static Atomic32 head;       /* next slot to write, only grows */
+static uint32_t tail = 0;   /* next slot to read */
+
+void Trace::doRecord(uint32_t event, uint32_t pid, uint32_t sig) {
+    TraceEvent* e = &ring[head.getThenAdd(1) % SIZE];
+    e->tsc = (uint32_t) rdtsc();
+    e->event = event;
+    e->sig = sig;
+    e->pid = pid;
+}
+
+long Trace::enable(bool on) {
+    Process::disable();
+    long old = enabled;
+    if (on && !enabled) {
+        /* start with an empty ring */
+        tail = head.get();
+    }
+    enabled = on;
+    Process::enable();
+    return old;
+}
+
+long Trace::read(TraceEvent* buf, long n) {
+    /* buf is user memory and copying into it can fault, so events go
+       through this under disable and out to buf after */
+    TraceEvent chunk[32];
+    long count = 0;
+    while (count < n) {
+        long m = 0;
+        Process::disable();
+        uint32_t h = head.get();
+        if (h - tail > SIZE) {
+            /* the writers lapped us */
+            tail = h - SIZE;
+        }
+        while ((m < 32) && (count + m < n) && (tail != h)) {
+            chunk[m++] = ring[tail % SIZE];
+            tail++;
+        }
+        Process::enable();
+        if (m == 0) break;
+        for (long i=0; i<m; i++) buf[count++] = chunk[i];
+    }
+    return count;
+}
@@ -0,0 +1,51 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include "stdint.h"
+#include "atomic.h"
+
+/*
+ * Signal tracepoints.
+ *
+ * A ring of timestamped events along a signal's path: sent, target
+ * dispatched with it pending, handler frame built, handler returned.
+ * Tracing is off until a user program turns it on, and recording is
+ * an rdtsc and a few stores so it's safe from interrupt handlers.
+ * When the ring is full the oldest events are overwritten.
+ */
+
+struct TraceEvent {
+    uint32_t tsc;       /* low half of the cycle counter */
+    uint16_t event;
+    uint16_t sig;
+    uint32_t pid;
+};
+
+class Trace {
+public:
+    enum {
+        SIG_ENQUEUE = 1,    /* Process::signal */
+        SIG_DISPATCH = 2,   /* the target is dispatched with it pending */
+        SIG_FRAME = 3,      /* the handler frame is on the user stack */
+        SIG_RETURN = 4      /* sys_sigret */
+    };
+
+    static constexpr uint32_t SIZE = 256;
+
+    static bool enabled;
+
+    static void record(uint32_t event, uint32_t pid, uint32_t sig) {
+        if (enabled) doRecord(event,pid,sig);
+    }
+
+    /* turn tracing on or off, returns the old setting */
+    static long enable(bool on);
+
+    /* move up to n of the oldest events to buf, returns how many */
+    static long read(TraceEvent* buf, long n);
+
+private:
+    static void doRecord(uint32_t event, uint32_t pid, uint32_t sig);
+};
+
+#endif
@@ -0,0 +1,144 @@
+#include "tty.h"
+#include "machine.h"
+#include "err.h"
+
+/* The console line discipline */
+
+Tty *Tty::console = nullptr;
+
+static uint32_t min(uint32_t a, uint32_t b) {
+    return (a < b) ? a : b;
+}
+
+void Tty::echo(char ch) {
+    if (mode & ECHO) {
+        uart->put(ch);
+    }
+}
+
+/* one more character of the line, true once it's complete */
+bool Tty::add(char ch) {
+    switch (ch) {
+    case '\r':
+    case '\n':
+        line[tail++] = '\n';
+        echo('\r');
+        echo('\n');
+        done = true;
+        break;
+    case 4: /* ^D, end of file */
+        done = true;
+        break;
+    case 8:
+    case 127: /* erase */
+        if (tail > 0) {
+            tail --;
+            echo(8); echo(' '); echo(8);
+        }
+        break;
+    case 21: /* ^U, kill the line */
+        while (tail > 0) {
+            tail --;
+            echo(8); echo(' '); echo(8);
+        }
+        break;
+    default:
+        /* leave room for the newline */
+        if (tail < LINE_MAX - 1) {
+            line[tail++] = ch;
+            echo(ch);
+        }
+    }
+    return done;
+}
+
+/* read characters until we have a complete line, or end of file. A
+   poller may have started it */
+void Tty::fillLine() {
+    while (!done) {
+        add(uart->get());
+    }
+}
+
+int32_t Tty::read(void *buf, uint32_t length) {
+    if (length == 0) return 0;
+
+    char* p = (char*) buf;
+    uint32_t n = 0;
+
+    /* another reader can wait for input forever */
+    if (!mutex.lockKillable()) return ERR_NOT_POSSIBLE;
+    if (mode & COOKED) {
+        reading = true;
+        fillLine();
+        reading = false;
+        n = min(length, tail - head);
+        memcpy(p, &line[head], n);
+        head += n;
+        if (head == tail) {
+            /* all of it went, start the next one */
+            head = 0;
+            tail = 0;
+            done = false;
+        }
+    } else {
+        /* block for the first character, take the rest if they're there */
+        do {
+            char ch = uart->get();
+            echo(ch);
+            p[n++] = ch;
+        } while ((n < length) && uart->ready());
+    }
+    mutex.unlock();
+
+    return n;
+}
+
+int32_t Tty::write(const void *buf, uint32_t length) {
+    const char* p = (const char*) buf;
+    for (uint32_t i=0; i<length; i++) {
+        uart->put(p[i]);
+    }
+    return length;
+}
+
+long Tty::ioctl(long cmd, long arg) {
+    switch (cmd) {
+    case GET_MODE:
+        return mode;
+    case SET_MODE:
+        mutex.lock();
+        mode = arg & (COOKED | ECHO);
+        /* a partial line doesn't survive a mode change */
+        head = 0;
+        tail = 0;
+        done = false;
+        mutex.unlock();
+        return 0;
+    default:
+        return ERR_NOT_POSSIBLE;
+    }
+}
+
+long Tty::poll(long events) {
+    long out = events & POLLOUT;
+    bool in;
+    if (mode & COOKED) {
+        /* a read only returns whole lines, so typed characters go into
+           the line here, unless a reader is already assembling it */
+        if (!reading) {
+            while (!done && uart->ready()) add(uart->get());
+        }
+        in = done;
+    } else {
+        in = uart->ready();
+    }
+    if (in) out |= events & POLLIN;
+    return out;
+}
+
+void Tty::handler() {
+    if (console) {
+        console->pollers.wakeAll();
+    }
+}
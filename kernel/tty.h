@@ -0,0 +1,79 @@
+#ifndef _TTY_H_
+#define _TTY_H_
+
+#include "resource.h"
+#include "semaphore.h"
+#include "u8250.h"
+#include "poll.h"
+
+/*
+ * The console line discipline.
+ *
+ * Sits on top of the U8250 and gives user programs a descriptor they
+ * can read from. In cooked mode the kernel does the echo, erase, and
+ * line assembly so a single read returns a whole line. In raw mode a
+ * read returns whatever characters are available (at least one).
+ */
+class Tty : public Resource {
+public:
+    /* mode bits */
+    static constexpr long COOKED = 1;
+    static constexpr long ECHO = 2;
+
+    /* ioctl commands */
+    static constexpr long GET_MODE = 1;
+    static constexpr long SET_MODE = 2;
+
+    static constexpr uint32_t LINE_MAX = 256;
+
+    /* the system console */
+    static Tty *console;
+    static void init(Tty *p) {
+        console = p;
+        /* the console is never deleted */
+        Resource::ref(p);
+        /* so pollers hear about input */
+        p->uart->enableReceiveInterrupt();
+    }
+
+    Tty(U8250 *uart) : Resource(ResourceType::TTY), uart(uart),
+        mode(COOKED | ECHO), head(0), tail(0), done(false), reading(false) {}
+
+    /* returns the number of bytes read, 0 => end of file */
+    int32_t read(void *buf, uint32_t length);
+
+    /* write to the console, returns length */
+    int32_t write(const void *buf, uint32_t length);
+
+    /* control the line discipline, returns an error code if not possible */
+    long ioctl(long cmd, long arg);
+
+    /* readable when a read wouldn't block (a whole line in cooked
+       mode), always writable */
+    virtual long poll(long events);
+    virtual PollQueue* pollQueue() { return &pollers; }
+
+    /* receive interrupt */
+    static void handler();
+
+private:
+    U8250 *uart;
+    Mutex mutex;
+    PollQueue pollers;
+    long mode;
+
+    /* the assembled line, characters in [head,tail) are not consumed yet */
+    char line[LINE_MAX];
+    uint32_t head;
+    uint32_t tail;
+    /* the line is complete (newline or end of file) */
+    bool done;
+    /* a cooked read is assembling the line, poll leaves it alone */
+    bool reading;
+
+    void echo(char ch);
+    bool add(char ch);
+    void fillLine();
+};
+
+#endif
@@ -11,10 +11,24 @@ void U8250::put(char c) {
     outb(0x3F8,c);
 }
 
+bool U8250::ready() {
+    return inb(0x3F8+5) & 0x01;
+}
+
+void U8250::enableReceiveInterrupt() {
+    outb(0x3F8+1, 0x01);                    /* IER: received data available */
+    outb(0x3F8+4, inb(0x3F8+4) | 0x08);     /* MCR: OUT2 gates the IRQ line */
+}
+
 char U8250::get() {
     getMutex.lock();
-    while (!(inb(0x3F8+5) & 0x01)) {
-       Process::yield();
+    while (!ready()) {
+        /* a reader that was killed gets end of file */
+        if ((Process::current != nullptr) && Process::current->isKillPending()) {
+            getMutex.unlock();
+            return 4;
+        }
+        Process::yield();
     }
     char x = inb(0x3F8);
     getMutex.unlock();
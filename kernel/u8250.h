@@ -17,6 +17,12 @@ public:
     U8250() {}
     virtual void put(char ch);
     virtual char get();
+
+    /* is there a character waiting to be read? */
+    bool ready();
+
+    /* raise IRQ4 when a character arrives */
+    void enableReceiveInterrupt();
 };
 
 #endif
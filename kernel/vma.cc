@@ -0,0 +1,163 @@
+#include "vma.h"
+#include "machine.h"
+
+VMAList::VMAList() : array(nullptr), n(0), capacity(0) {
+}
+
+VMAList::~VMAList() {
+    clear();
+    delete[] array;
+}
+
+uint32_t VMAList::search(uint32_t va) {
+    uint32_t lo = 0;
+    uint32_t hi = n;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (array[mid].end <= va) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void VMAList::insertAt(uint32_t i, const VMA& area) {
+    if (n == capacity) {
+        uint32_t more = (capacity == 0) ? 8 : capacity * 2;
+        VMA* bigger = new VMA[more];
+        memcpy(bigger,array,n * sizeof(VMA));
+        delete[] array;
+        array = bigger;
+        capacity = more;
+    }
+    for (uint32_t j = n; j > i; j--) {
+        array[j] = array[j-1];
+    }
+    array[i] = area;
+    n++;
+    /* each area holds its pager */
+    if (area.pager) area.pager->attach();
+}
+
+void VMAList::removeAt(uint32_t i) {
+    if (array[i].pager) array[i].pager->detach();
+    for (uint32_t j = i + 1; j < n; j++) {
+        array[j-1] = array[j];
+    }
+    n--;
+}
+
+VMA* VMAList::find(uint32_t va) {
+    uint32_t i = search(va);
+    if ((i < n) && (array[i].start <= va)) return &array[i];
+    return nullptr;
+}
+
+uint32_t VMAList::findGap(uint32_t len, uint32_t low, uint32_t high, uint32_t align) {
+    uint32_t at = (low + align - 1) & ~(align - 1);
+    if (at < low) return 0;
+    for (uint32_t i = search(at); i < n; i++) {
+        if (array[i].start >= at + len) break;
+        if (array[i].end > at) at = (array[i].end + align - 1) & ~(align - 1);
+    }
+    if ((at + len > high) || (at + len < at)) return 0;
+    return at;
+}
+
+bool VMAList::covers(uint32_t start, uint32_t end) {
+    uint32_t at = start;
+    for (uint32_t i = search(start); (i < n) && (at < end); i++) {
+        if (array[i].start > at) return false;
+        at = array[i].end;
+    }
+    return at >= end;
+}
+
+/* does b carry on where a stops */
+static bool continues(const VMA& a, const VMA& b) {
+    return (a.end == b.start) && (a.prot == b.prot) && (a.flags == b.flags) &&
+        (a.pager == b.pager) && ((a.pager == nullptr) || (a.offsetOf(a.end) == b.offset));
+}
+
+void VMAList::add(uint32_t start, uint32_t end, uint32_t prot, uint32_t flags,
+    Pager* pager, uint32_t offset)
+{
+    uint32_t i = search(start);
+    VMA area = { start, end, prot, flags, pager, offset };
+
+    /* grow a neighbor if it looks the same */
+    bool left = (i > 0) && continues(array[i-1],area);
+    bool right = (i < n) && continues(area,array[i]);
+
+    if (left && right) {
+        array[i-1].end = array[i].end;
+        removeAt(i);
+    } else if (left) {
+        array[i-1].end = end;
+    } else if (right) {
+        array[i].start = start;
+        array[i].offset = offset;
+    } else {
+        insertAt(i,area);
+    }
+}
+
+void VMAList::remove(uint32_t start, uint32_t end) {
+    uint32_t i = search(start);
+    while ((i < n) && (array[i].start < end)) {
+        VMA& a = array[i];
+        if ((a.start < start) && (a.end > end)) {
+            /* a hole in the middle */
+            VMA tail = a;
+            tail.offset = a.offsetOf(end);
+            tail.start = end;
+            a.end = start;
+            insertAt(i + 1,tail);
+            return;
+        } else if (a.start < start) {
+            a.end = start;
+            i++;
+        } else if (a.end > end) {
+            a.offset = a.offsetOf(end);
+            a.start = end;
+            return;
+        } else {
+            removeAt(i);
+        }
+    }
+}
+
+void VMAList::protect(uint32_t start, uint32_t end, uint32_t prot) {
+    /* cut the range out and put it back with the new protection,
+       one area at a time so the flags survive */
+    uint32_t at = start;
+    while (at < end) {
+        VMA* a = find(at);
+        uint32_t stop = (a->end < end) ? a->end : end;
+        uint32_t flags = a->flags;
+        Pager* pager = a->pager;
+        uint32_t offset = a->offsetOf(at);
+        /* removing the last area on it could free the pager */
+        if (pager) pager->attach();
+        remove(at,stop);
+        add(at,stop,prot,flags,pager,offset);
+        if (pager) pager->detach();
+        at = stop;
+    }
+}
+
+void VMAList::copyFrom(VMAList* other) {
+    clear();
+    for (uint32_t i = 0; i < other->n; i++) {
+        insertAt(n,other->array[i]);
+    }
+}
+
+void VMAList::clear() {
+    for (uint32_t i = 0; i < n; i++) {
+        if (array[i].pager) array[i].pager->detach();
+    }
+    n = 0;
+}
@@ -0,0 +1,93 @@
+#ifndef _VMA_H_
+#define _VMA_H_
+
+#include "stdint.h"
+
+/* where the pages of a file mapping come from */
+class Pager {
+public:
+    /* the frame holding page n, read in if needed, 0 past the end.
+       It belongs to the pager, nobody else frees it */
+    virtual uint32_t page(uint32_t n) = 0;
+
+    /* an area starts or stops using it, called with interrupts
+       disabled. Pagers that can go away count these */
+    virtual void attach() {}
+    virtual void detach() {}
+};
+
+/* a range of user mmap memory, [start,end) */
+struct VMA {
+    /* prot */
+    static constexpr uint32_t READ = 1;
+    static constexpr uint32_t WRITE = 2;
+    static constexpr uint32_t EXEC = 4;
+
+    /* flags */
+    static constexpr uint32_t SHARED = 1;
+    static constexpr uint32_t PRIVATE = 2;
+    static constexpr uint32_t FIXED = 0x10;
+    static constexpr uint32_t ANONYMOUS = 0x20;
+    /* private anonymous memory in 4MB pages where they fit */
+    static constexpr uint32_t LARGE = 0x40000;
+
+    uint32_t start;
+    uint32_t end;
+    uint32_t prot;
+    uint32_t flags;
+    /* file mappings, start maps offset in the file */
+    Pager* pager;
+    uint32_t offset;
+
+    /* the file offset of va */
+    uint32_t offsetOf(uint32_t va) const {
+        return offset + (va - start);
+    }
+};
+
+/*
+ * The areas of an address space, sorted by address in an array that
+ * grows as needed. Lookups are a binary search; a process has a handful
+ * of areas, so moving the tail on insert is cheap.
+ *
+ * The caller keeps it consistent, AddressSpace does that with
+ * interrupts disabled.
+ */
+class VMAList {
+    VMA* array;
+    uint32_t n;
+    uint32_t capacity;
+
+    /* index of the first area that ends above va */
+    uint32_t search(uint32_t va);
+    void insertAt(uint32_t i, const VMA& area);
+    void removeAt(uint32_t i);
+public:
+    VMAList();
+    ~VMAList();
+
+    /* the area containing va, nullptr if none */
+    VMA* find(uint32_t va);
+
+    /* the lowest free range of len bytes in [low,high) that starts
+       on a multiple of align (a power of two), 0 if none */
+    uint32_t findGap(uint32_t len, uint32_t low, uint32_t high, uint32_t align = 4096);
+
+    /* is all of [start,end) covered */
+    bool covers(uint32_t start, uint32_t end);
+
+    /* add an area over a free range, merging with equal neighbors */
+    void add(uint32_t start, uint32_t end, uint32_t prot, uint32_t flags,
+        Pager* pager = nullptr, uint32_t offset = 0);
+
+    /* remove [start,end), cutting areas that stick out */
+    void remove(uint32_t start, uint32_t end);
+
+    /* change the protection of a covered range */
+    void protect(uint32_t start, uint32_t end, uint32_t prot);
+
+    void copyFrom(VMAList* other);
+    void clear();
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include "vmalloc.h"
+#include "vmm.h"
+#include "process.h"
+#include "debug.h"
+
+#define PAGES ((KernelMemory::VMALLOC_END - KernelMemory::VMALLOC_BASE) / PhysMem::FRAME_SIZE)
+
+/* page i of the region is taken, mapped or a guard */
+static uint32_t taken[PAGES / 32];
+
+/* who each allocation is charged to, by its first page */
+static Heap::Account* owners[PAGES];
+
+/* where the last allocation ended */
+static uint32_t hint = 0;
+
+static inline bool isTaken(uint32_t i) {
+    return (taken[i / 32] & (1u << (i % 32))) != 0;
+}
+
+static inline uint32_t pageVA(uint32_t i) {
+    return KernelMemory::VMALLOC_BASE + i * PhysMem::FRAME_SIZE;
+}
+
+/* the first of n free pages in a row, PAGES if there aren't any */
+static uint32_t find(uint32_t n) {
+    uint32_t run = 0;
+    for (uint32_t k = 0; k < PAGES; k++) {
+        uint32_t i = (hint + k) % PAGES;
+        /* runs don't wrap around */
+        if ((i == 0) || isTaken(i)) run = 0;
+        if (isTaken(i)) continue;
+        run ++;
+        if (run == n) return i + 1 - n;
+    }
+    return PAGES;
+}
+
+void* VMalloc::alloc(size_t bytes, Heap::Account* account) {
+    uint32_t n = (bytes + PhysMem::FRAME_SIZE - 1) / PhysMem::FRAME_SIZE;
+
+    Process::disable();
+    /* and the guard page */
+    uint32_t first = find(n + 1);
+    if (first == PAGES) {
+        Debug::panic("vmalloc region is full, bytes=0x%x",bytes);
+    }
+    for (uint32_t i = first; i <= first + n; i++) {
+        taken[i / 32] |= 1u << (i % 32);
+    }
+    hint = first + n + 1;
+    owners[first] = account;
+    Heap::charge(account,n * PhysMem::FRAME_SIZE);
+    Process::enable();
+
+    for (uint32_t i = first; i < first + n; i++) {
+        KernelMemory::map(pageVA(i),PhysMem::alloc());
+    }
+    return (void*) pageVA(first);
+}
+
+void VMalloc::free(void* p) {
+    uint32_t va = (uint32_t) p;
+    if ((va & (PhysMem::FRAME_SIZE - 1)) != 0) {
+        Debug::panic("vfree of %p\n",p);
+    }
+    uint32_t first = (va - KernelMemory::VMALLOC_BASE) / PhysMem::FRAME_SIZE;
+
+    /* the guard page ends it */
+    uint32_t i = first;
+    while (true) {
+        uint32_t pa = KernelMemory::unmap(pageVA(i));
+        if (pa == 0) break;
+        PhysMem::free(pa);
+        i++;
+    }
+    if (i == first) {
+        Debug::panic("vfree of %p, not allocated\n",p);
+    }
+
+    Process::disable();
+    for (uint32_t j = first; j <= i; j++) {
+        taken[j / 32] &= ~(1u << (j % 32));
+    }
+    Heap::Account* account = owners[first];
+    owners[first] = nullptr;
+    Heap::refund(account,(i - first) * PhysMem::FRAME_SIZE);
+    Process::enable();
+}
+
+bool VMalloc::owns(void* p) {
+    uint32_t va = (uint32_t) p;
+    return (va >= KernelMemory::VMALLOC_BASE) && (va < KernelMemory::VMALLOC_END);
+}
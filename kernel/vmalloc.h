@@ -0,0 +1,28 @@
+#ifndef _VMALLOC_H_
+#define _VMALLOC_H_
+
+#include "stdint.h"
+#include "heap.h"
+
+/*
+ * Large kernel allocations.
+ *
+ * Each one gets its own run of pages in the vmalloc region, backed by
+ * frames from PhysMem and followed by an unmapped guard page. Freeing
+ * one gives its frames straight back, so a big table doesn't leave a
+ * hole in the heap, and running off the end faults.
+ */
+class VMalloc {
+public:
+    /* malloc sends requests at least this big here */
+    static constexpr uint32_t LARGE = 4 * 4096;
+
+    /* charged to account like a heap block */
+    static void* alloc(size_t bytes, Heap::Account* account);
+    static void free(void* p);
+
+    /* did p come from alloc */
+    static bool owns(void* p);
+};
+
+#endif
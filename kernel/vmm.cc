@@ -6,15 +6,28 @@
 #include "gdt.h"
 #include "libk.h"
 #include "err.h"
+#include "kstack.h"
+#include "swap.h"
+#include "merge.h"
+#include "oom.h"
+
+#define CPUID_PSE (1 << 3)
+#define CR4_PSE (1 << 4)
 
 PhysMem::Node *PhysMem::firstFree = 0;
+uint32_t PhysMem::nFree = 0;
+PhysMem::Node *PhysMem::firstLarge = 0;
+uint32_t PhysMem::nLarge = 0;
 uint32_t PhysMem::avail;
 uint32_t PhysMem::limit;
 
 void PhysMem::init(uint32_t start, uint32_t end) {
     avail = start;
-    limit = end;
+    limit = (end < KernelMemory::PHYS_END) ? end : KernelMemory::PHYS_END;
     firstFree = 0;
+    nFree = 0;
+    firstLarge = 0;
+    nLarge = 0;
 
     /* register the page fault handler */
     setTrapDescriptor(&idt[14],kernelCodeSeg,(uint32_t)pageFaultHandler,0);
@@ -22,17 +35,28 @@ void PhysMem::init(uint32_t start, uint32_t end) {
 
 uint32_t PhysMem::alloc() {
     Process::disable();
-    uint32_t p;
+    uint32_t p = 0;
 
     if (firstFree) {
         p = (uint32_t) firstFree;
         firstFree = firstFree->next;
-    } else {
-        if (avail == limit) {
-            Debug::panic("no more frames");
-        }
+        nFree --;
+    } else if (avail != limit) {
         p = avail;
         avail += FRAME_SIZE;
+    } else if (firstLarge) {
+        /* break up a large block, the rest goes on the free list */
+        p = (uint32_t) firstLarge;
+        firstLarge = firstLarge->next;
+        nLarge --;
+        for (uint32_t f = p + LARGE_SIZE - FRAME_SIZE; f != p; f -= FRAME_SIZE) {
+            Node* n = (Node*) f;
+            n->next = firstFree;
+            firstFree = n;
+            nFree ++;
+        }
+    } else {
+        Debug::panic("no more frames");
     }
     Process::enable();
 
@@ -41,52 +65,281 @@ uint32_t PhysMem::alloc() {
     return p;
 }
 
+uint32_t PhysMem::allocLarge() {
+    Process::disable();
+    uint32_t p = 0;
+
+    if (firstLarge) {
+        p = (uint32_t) firstLarge;
+        firstLarge = firstLarge->next;
+        nLarge --;
+    } else {
+        uint32_t at = (avail + LARGE_SIZE - 1) & ~(LARGE_SIZE - 1);
+        /* leave swap room to work with */
+        if ((at < limit) && (limit - at >= LARGE_SIZE) &&
+                (freeFrames() >= LARGE_SIZE / FRAME_SIZE + Swap::HIGH)) {
+            /* the frames skipped to get aligned go on the free list */
+            for (uint32_t f = avail; f < at; f += FRAME_SIZE) {
+                Node* n = (Node*) f;
+                n->next = firstFree;
+                firstFree = n;
+                nFree ++;
+            }
+            p = at;
+            avail = at + LARGE_SIZE;
+        }
+    }
+    Process::enable();
+
+    if (p != 0) K::bzero((void*)p,LARGE_SIZE);
+
+    return p;
+}
+
+void PhysMem::freeLarge(uint32_t p) {
+    Process::disable();
+
+    Node* n = (Node*) p;
+    n->next = firstLarge;
+    firstLarge = n;
+    nLarge ++;
+
+    Process::enable();
+}
+
 void PhysMem::free(uint32_t p) {
     Process::disable();
 
     Node* n = (Node*) p;
     n->next = firstFree;
     firstFree = n;
+    nFree ++;
 
     Process::enable();
 }
 
+void PhysMem::FrameList::add(uint32_t frame) {
+    Node* n = (Node*) frame;
+    n->next = head;
+    head = n;
+    if (tail == nullptr) tail = n;
+    this->n ++;
+}
 
-AddressSpace::AddressSpace() {
-    pd = (uint32_t*) PhysMem::alloc();
+void PhysMem::free(FrameList& list) {
+    if (list.head == nullptr) return;
+    Process::disable();
+
+    list.tail->next = firstFree;
+    firstFree = list.head;
+    nFree += list.n;
+
+    Process::enable();
+    list = FrameList();
+}
+
+uint32_t PhysMem::freeFrames() {
+    return nFree + (limit - avail) / FRAME_SIZE + nLarge * (LARGE_SIZE / FRAME_SIZE);
+}
+
+static uint32_t cmos(uint32_t reg) {
+    outb(0x70,reg);
+    return inb(0x71) & 0xff;
+}
+
+uint32_t PhysMem::probe() {
+    /* 64K blocks above 16M, only set when there is more than 16M */
+    uint32_t high = cmos(0x34) | (cmos(0x35) << 8);
+    if (high != 0) {
+        return 0x1000000 + (high << 16);
+    }
+    /* 1K blocks above 1M */
+    uint32_t low = cmos(0x30) | (cmos(0x31) << 8);
+    return 0x100000 + (low << 10);
+}
+
+/* the kernel page directory */
+static uint32_t* kernelPD = nullptr;
+
+static uint32_t& kernelPTE(uint32_t va) {
+    uint32_t i0 = va >> 22;
+    if ((kernelPD[i0] & AddressSpace::P) == 0) {
+        kernelPD[i0] = PhysMem::alloc() | AddressSpace::W | AddressSpace::P;
+    }
+    uint32_t* pt = (uint32_t*) (kernelPD[i0] & 0xfffff000);
+    return pt[(va >> 12) & 0x3ff];
+}
+
+void KernelMemory::init() {
+    AddressSpace::zeroFrame = PhysMem::alloc();
+    kernelPD = (uint32_t*) PhysMem::alloc();
+    /* page 0 stays unmapped to catch null pointers */
     for (uint32_t va = PhysMem::FRAME_SIZE;
         va < PhysMem::limit;
         va += PhysMem::FRAME_SIZE
     ) {
-        pmap(va,va,false,true);
+        kernelPTE(va) = va | AddressSpace::W | AddressSpace::P;
     }
-    //dump();
+    KernelStack::mapInto(kernelPD);
+    /* 4MB pages, only user memory asks for them */
+    if (cpuidEdx(1) & CPUID_PSE) {
+        setcr4(getcr4() | CR4_PSE);
+        AddressSpace::largePages = true;
+    }
+    vmm_on((uint32_t) kernelPD);
 }
 
-AddressSpace::~AddressSpace() {
-    for (int i0 = 0; i0 < 1024; i0++) {
-        uint32_t pde = pd[i0];
-        if (pde & P) {
-            uint32_t *pt = (uint32_t*) (pde & 0xfffff000);
-            if (i0 > 0) {
-                for (uint32_t i1 = 0; i1 < 1024; i1++) {
-                    uint32_t pte = pt[i1];
-                    if (pte & P) {
-                        uint32_t pa = pte & 0xfffff000;
-                        PhysMem::free(pa);
-                    }
-                }
-            }
-            PhysMem::free((uint32_t) pt);
+void KernelMemory::mapInto(uint32_t* pd) {
+    for (uint32_t i0 = 0; i0 < (USER_BASE >> 22); i0++) {
+        pd[i0] = kernelPD[i0];
+    }
+    KernelStack::mapInto(pd);
+}
+
+void KernelMemory::map(uint32_t va, uint32_t pa) {
+    Process::disable();
+    kernelPTE(va) = (pa & 0xfffff000) | AddressSpace::W | AddressSpace::P;
+    invlpg(va);
+    Process::enable();
+}
+
+uint32_t KernelMemory::unmap(uint32_t va) {
+    uint32_t pa = 0;
+    Process::disable();
+    uint32_t pde = kernelPD[va >> 22];
+    if (pde & AddressSpace::P) {
+        uint32_t* pt = (uint32_t*) (pde & 0xfffff000);
+        uint32_t pte = pt[(va >> 12) & 0x3ff];
+        if (pte & AddressSpace::P) {
+            pa = pte & 0xfffff000;
+            pt[(va >> 12) & 0x3ff] = 0;
+            invlpg(va);
         }
     }
+    Process::enable();
+    return pa;
+}
+
+bool KernelMemory::syncFault(uint32_t va) {
+    if ((kernelPD == nullptr) || (va >= USER_BASE)) return false;
+    uint32_t i0 = va >> 22;
+    uint32_t* pd = (uint32_t*) (getcr3() & 0xfffff000);
+    if ((pd[i0] & AddressSpace::P) || !(kernelPD[i0] & AddressSpace::P)) {
+        return false;
+    }
+    pd[i0] = kernelPD[i0];
+    return true;
+}
+
+
+static inline uint32_t pageUp(uint32_t va) {
+    return (va + PhysMem::FRAME_SIZE - 1) & ~(PhysMem::FRAME_SIZE - 1);
+}
+
+/* free what an entry that was taken out held: a mapped frame unless a
+   pager owns it (onto frames), a reference to a merged frame, or a
+   swap slot */
+static inline void release(uint32_t pte, PhysMem::FrameList& frames) {
+    if (Swap::isSwapped(pte)) {
+        Swap::discard(pte);
+    } else if ((pte & (AddressSpace::P | AddressSpace::CACHED)) == AddressSpace::P) {
+        if (pte & AddressSpace::COW) {
+            Merge::put(pte & 0xfffff000);
+        } else {
+            Swap::untrack(pte & 0xfffff000);
+            frames.add(pte & 0xfffff000);
+        }
+    }
+}
+
+void UnmapBatch::page(uint32_t va, uint32_t pte) {
+    if (nPages == PAGES) flush();
+    vas[nPages] = va;
+    ptes[nPages] = pte;
+    nPages ++;
+}
+
+void UnmapBatch::table(uint32_t* pt) {
+    if (nTables == TABLES) flush();
+    tables[nTables++] = pt;
+}
+
+void UnmapBatch::large(uint32_t frame) {
+    if (nBlocks == TABLES) flush();
+    blocks[nBlocks++] = frame;
+}
+
+void UnmapBatch::flush() {
+    if (nPages + nTables + nBlocks == 0) return;
+
+    uint32_t cr3 = (uint32_t) space->pd;
+    if ((getcr3() & 0xfffff000) == cr3) {
+        if ((nTables == 0) && (nBlocks == 0) && (nPages <= INVLPG_MAX)) {
+            for (uint32_t i = 0; i < nPages; i++) invlpg(vas[i]);
+        } else {
+            setcr3(cr3);
+        }
+    }
+
+    PhysMem::FrameList frames;
+    for (uint32_t i = 0; i < nPages; i++) {
+        release(ptes[i],frames);
+    }
+    for (uint32_t i = 0; i < nTables; i++) {
+        uint32_t* pt = tables[i];
+        for (uint32_t i1 = 0; i1 < 1024; i1++) {
+            if (pt[i1] != 0) release(pt[i1],frames);
+        }
+    }
+    space->resident.getThenAdd(-(frames.size() + nBlocks * (PhysMem::LARGE_SIZE / PhysMem::FRAME_SIZE)));
+    for (uint32_t i = 0; i < nTables; i++) {
+        frames.add((uint32_t) tables[i]);
+    }
+    space->tables.getThenAdd(-nTables);
+    for (uint32_t i = 0; i < nBlocks; i++) {
+        PhysMem::freeLarge(blocks[i]);
+    }
+    PhysMem::free(frames);
+
+    nPages = 0;
+    nTables = 0;
+    nBlocks = 0;
+}
+
+uint32_t AddressSpace::zeroFrame = 0;
+Atomic32 AddressSpace::zeroHits;
+Atomic32 AddressSpace::zeroCopies;
+bool AddressSpace::largePages = false;
+Atomic32 AddressSpace::largeMaps;
+Atomic32 AddressSpace::largeSplits;
+
+void AddressSpace::report() {
+    Debug::printf("zero page: %d pages mapped, %d written\n",
+        zeroHits.get(),zeroCopies.get());
+    Debug::printf("large pages: %d mapped, %d split\n",
+        largeMaps.get(),largeSplits.get());
+}
+
+AddressSpace::AddressSpace() : Resource(ResourceType::ADDRESS_SPACE),
+    heapStart(0x80000000), heapEnd(0x80000000)
+{
+    pd = (uint32_t*) PhysMem::alloc();
+    tables.set(1);
+    KernelMemory::mapInto(pd);
+    //dump();
+}
+
+AddressSpace::~AddressSpace() {
+    dropAll();
     PhysMem::free((uint32_t) pd);
 }
 
 void AddressSpace::dump() {
     for (int i0 = 0; i0 < 1024; i0++) {
         uint32_t pde = pd[i0];
-        if (pde & P) {
+        if (pde & LARGE) {
+            Debug::printf("%d -> %x (4MB)\n",i0,pde);
+        } else if (pde & P) {
             Debug::printf("%d\n",i0);
             uint32_t *pt = (uint32_t*) (pde & 0xfffff000);
             uint32_t high = i0 << 22;
@@ -105,11 +358,84 @@ uint32_t& AddressSpace::getPTE(uint32_t va) {
     uint32_t i0 = (va >> 22) & 0x3ff;
     if ((pd[i0] & P) == 0) {
         pd[i0] = PhysMem::alloc() | 7; /* UWP */
+        tables.getThenAdd(1);
+    } else if (pd[i0] & LARGE) {
+        /* one of its pages is about to change on its own */
+        split(i0);
     }
     uint32_t* pt = (uint32_t*) (pd[i0] & 0xfffff000);
     return pt[(va >> 12) & 0x3ff];
 }
 
+static inline bool userPDE(uint32_t i0) {
+    uint32_t va = i0 << 22;
+    if (va < KernelMemory::USER_BASE) return false;
+    return (va < KernelStack::BASE) || (va >= KernelStack::END);
+}
+
+void AddressSpace::dropAll() {
+    UnmapBatch batch(this);
+    for (uint32_t i0 = 0; i0 < 1024; i0++) {
+        if (!userPDE(i0)) continue;
+        /* out of the directory, swap and merging can't find it now */
+        Process::disable();
+        uint32_t pde = pd[i0];
+        pd[i0] = 0;
+        Process::enable();
+        if (pde & LARGE) {
+            batch.large(pde & 0xffc00000);
+        } else if (pde & P) {
+            batch.table((uint32_t*) (pde & 0xfffff000));
+        }
+    }
+}
+
+/* precondition: disabled */
+void AddressSpace::split(uint32_t i0) {
+    uint32_t pde = pd[i0];
+    uint32_t base = pde & 0xffc00000;
+    uint32_t* pt = (uint32_t*) PhysMem::alloc();
+    for (uint32_t i1 = 0; i1 < 1024; i1++) {
+        uint32_t frame = base + (i1 << 12);
+        pt[i1] = frame | (pde & (U | W | P));
+        /* ordinary private frames from now on */
+        Swap::track(frame,this,(i0 << 22) | (i1 << 12));
+    }
+    pd[i0] = (uint32_t) pt | 7; /* UWP */
+    tables.getThenAdd(1);
+    /* drops the whole 4MB translation */
+    invlpg(i0 << 22);
+    largeSplits.getThenAdd(1);
+}
+
+uint32_t AddressSpace::physical(uint32_t va) {
+    uint32_t pde = pd[(va >> 22) & 0x3ff];
+    if ((pde & P) == 0) return 0;
+    if (pde & LARGE) return (pde & 0xffc00000) | (va & 0x3fffff);
+    uint32_t* pt = (uint32_t*) (pde & 0xfffff000);
+    uint32_t pte = pt[(va >> 12) & 0x3ff];
+    if ((pte & P) == 0) return 0;
+    return (pte & 0xfffff000) | (va & 0xfff);
+}
+
+uint32_t AddressSpace::entry(uint32_t va) {
+    uint32_t pde = pd[(va >> 22) & 0x3ff];
+    if ((pde & P) == 0) return 0;
+    if (pde & LARGE) {
+        /* what a 4K entry for the page would say */
+        return (pde & 0xffc00000) | (va & 0x3ff000) | (pde & (ACCESSED | U | W | P));
+    }
+    uint32_t* pt = (uint32_t*) (pde & 0xfffff000);
+    return pt[(va >> 12) & 0x3ff];
+}
+
+uint32_t* AddressSpace::pteOf(uint32_t va) {
+    uint32_t pde = pd[(va >> 22) & 0x3ff];
+    if ((pde & (P | LARGE)) != P) return nullptr;
+    uint32_t* pt = (uint32_t*) (pde & 0xfffff000);
+    return &pt[(va >> 12) & 0x3ff];
+}
+
 void AddressSpace::punmap(uint32_t va) {
     Process::disable();
     getPTE(va) = 0;
@@ -117,32 +443,307 @@ void AddressSpace::punmap(uint32_t va) {
     Process::enable();
 }
 
+/* precondition: disabled */
+void AddressSpace::set(uint32_t va, uint32_t pte) {
+    uint32_t& at = getPTE(va);
+    uint32_t old = at;
+    at = pte;
+    /* the TLB doesn't keep entries that aren't present. One taken out
+       by unmapRange may still be there until its batch is flushed, but
+       the range isn't given out again before that */
+    if (old & P) invlpg(va);
+}
+
 void AddressSpace::pmap(uint32_t va, uint32_t pa, bool forUser, bool forWrite) {
     Process::disable();
-    invlpg(va);
-    getPTE(va) = (pa & 0xfffff000) |
-          (forUser ? U : 0) | (forWrite ? W : 0) | 1;
+    set(va,(pa & 0xfffff000) | (forUser ? U : 0) | (forWrite ? W : 0) | P);
+    Swap::track(pa & 0xfffff000,this,va);
+    resident.getThenAdd(1);
     Process::enable();
 }
 
-// creates a mapping for this virtual address.
-//
-// returns
-// va if success
-// 0  if already mapped
-// <0 if failed
-long AddressSpace::mmap(uint32_t va) {
-    // check if the address is already mapped
-    uint32_t i0 = (va >> 22) & 0x3ff;
-    if ((pd[i0] & P) != 0) {
-        uint32_t* pt = (uint32_t*) (pd[i0] & 0xfffff000);
-        if((pt[(va >> 12) & 0x3ff] & P) != 0) {
-            return 0;
+void AddressSpace::share(uint32_t va, uint32_t frame) {
+    Process::disable();
+    set(va,(frame & 0xfffff000) | CACHED | U | P);
+    Process::enable();
+}
+
+void AddressSpace::mapZero(uint32_t va) {
+    zeroHits.getThenAdd(1);
+    Process::disable();
+    set(va,zeroFrame | CACHED | COW | U | P);
+    Process::enable();
+}
+
+void AddressSpace::copyOnWrite(uint32_t va, uint32_t pte) {
+    uint32_t frame = pte & 0xfffff000;
+    /* alloc hands out zeroed frames, nothing to copy */
+    uint32_t copy = PhysMem::alloc();
+    if (frame == zeroFrame) {
+        zeroCopies.getThenAdd(1);
+    } else {
+        memcpy((void*) copy,(void*) frame,PhysMem::FRAME_SIZE);
+    }
+    Process::disable();
+    /* another thread may have beaten us to it */
+    if (entry(va) == pte) {
+        pmap(va,copy,true,true);
+        /* not a pager's, a merged frame */
+        if ((pte & CACHED) == 0) Merge::put(frame);
+        copy = 0;
+    }
+    Process::enable();
+    if (copy != 0) PhysMem::free(copy);
+}
+
+void AddressSpace::unmapRange(uint32_t start, uint32_t end) {
+    UnmapBatch batch(this);
+    uint32_t va = start;
+    while (va < end) {
+        uint32_t i0 = va >> 22;
+        uint32_t next = (i0 + 1) << 22;
+
+        Process::disable();
+        uint32_t pde = pd[i0];
+        if ((pde & P) && ((va & (PhysMem::LARGE_SIZE - 1)) == 0) &&
+                (end - va >= PhysMem::LARGE_SIZE)) {
+            /* all of this 4MB goes, its table or large page with it */
+            pd[i0] = 0;
+            Process::enable();
+            if (pde & LARGE) {
+                batch.large(pde & 0xffc00000);
+            } else {
+                batch.table((uint32_t*) (pde & 0xfffff000));
+            }
+            va = next;
+            if (va == 0) break;
+            continue;
+        }
+        if (pde & LARGE) split(i0);
+        uint32_t* pte = pteOf(va);
+        uint32_t old = 0;
+        if (pte != nullptr) {
+            old = *pte;
+            *pte = 0;
+        }
+        Process::enable();
+
+        if (pte == nullptr) {
+            /* nothing in this 4MB */
+            va = next;
+            if (va == 0) break;
+            continue;
+        }
+        if (old != 0) batch.page(va,old);
+        va += PhysMem::FRAME_SIZE;
+    }
+}
+
+long AddressSpace::mmap(uint32_t addr, uint32_t len, uint32_t prot, uint32_t flags,
+    Pager* pager, uint32_t offset)
+{
+    uint32_t low = KernelMemory::USER_BASE;
+    uint32_t high = KernelStack::BASE;
+    if ((len == 0) || (len > high - low)) return ERR_NOT_POSSIBLE;
+    len = pageUp(len);
+    uint32_t keep = flags & (VMA::SHARED | VMA::PRIVATE | VMA::ANONYMOUS);
+    /* only private anonymous memory comes in large pages */
+    uint32_t align = PhysMem::FRAME_SIZE;
+    if ((flags & VMA::LARGE) && largePages && (pager == nullptr) && !(flags & VMA::SHARED)) {
+        keep |= VMA::LARGE;
+        align = PhysMem::LARGE_SIZE;
+        len = (len + align - 1) & ~(align - 1);
+        if ((len == 0) || (len > high - low)) return ERR_NOT_POSSIBLE;
+    }
+
+    if (flags & VMA::FIXED) {
+        if (((addr & 0xfff) != 0) || (addr < low) || (addr > high - len)) {
+            return ERR_NOT_POSSIBLE;
+        }
+        /* replaces whatever was there */
+        munmap(addr,len);
+        Process::disable();
+        vmas.add(addr,addr + len,prot,keep,pager,offset);
+        Process::enable();
+        return addr;
+    }
+
+    /* addr is a hint */
+    uint32_t hint = addr & 0xfffff000;
+    if ((hint < low) || (hint >= high)) hint = low;
+    Process::disable();
+    uint32_t at = vmas.findGap(len,hint,high,align);
+    if ((at == 0) && (hint != low)) at = vmas.findGap(len,low,high,align);
+    if (at != 0) vmas.add(at,at + len,prot,keep,pager,offset);
+    Process::enable();
+    return (at == 0) ? ERR_NOT_POSSIBLE : at;
+}
+
+long AddressSpace::munmap(uint32_t addr, uint32_t len) {
+    if (((addr & 0xfff) != 0) || (len == 0) || (addr < KernelMemory::USER_BASE) ||
+            (len > KernelStack::BASE - addr)) {
+        return ERR_NOT_POSSIBLE;
+    }
+    uint32_t end = pageUp(addr + len);
+    /* the pages go first, while the areas still keep their pagers'
+       frames alive and the range from being handed out again */
+    unmapRange(addr,end);
+    Process::disable();
+    vmas.remove(addr,end);
+    Process::enable();
+    /* anything another thread faulted in meanwhile */
+    unmapRange(addr,end);
+    return 0;
+}
+
+long AddressSpace::mprotect(uint32_t addr, uint32_t len, uint32_t prot) {
+    if (((addr & 0xfff) != 0) || (len == 0) || (addr < KernelMemory::USER_BASE) ||
+            (len > KernelStack::BASE - addr)) {
+        return ERR_NOT_POSSIBLE;
+    }
+    uint32_t end = pageUp(addr + len);
+    Process::disable();
+    if (!vmas.covers(addr,end)) {
+        Process::enable();
+        return ERR_NOT_POSSIBLE;
+    }
+    vmas.protect(addr,end,prot);
+
+    /* pages that are already there, PROT_NONE keeps them for the kernel */
+    for (uint32_t va = addr; va < end; va += PhysMem::FRAME_SIZE) {
+        uint32_t& pde = pd[va >> 22];
+        if ((pde & P) == 0) continue;
+        if ((pde & LARGE) && ((va & (PhysMem::LARGE_SIZE - 1)) == 0) &&
+                (end - va >= PhysMem::LARGE_SIZE)) {
+            /* the whole large page changes, it stays one */
+            pde &= ~(U | W);
+            if (prot != 0) pde |= U;
+            if (prot & VMA::WRITE) pde |= W;
+            invlpg(va);
+            va += PhysMem::LARGE_SIZE - PhysMem::FRAME_SIZE;
+            continue;
+        }
+        uint32_t& pte = getPTE(va);
+        if ((pte & (P | SWAPPED)) == 0) continue;
+        pte &= ~(U | W);
+        if (prot != 0) pte |= U;
+        /* copy on write frames stay read only */
+        if ((prot & VMA::WRITE) && !(pte & COW)) pte |= W;
+        invlpg(va);
+    }
+    Process::enable();
+    return 0;
+}
+
+bool AddressSpace::faultIn(uint32_t va, bool write) {
+    Process::disable();
+    VMA* found = vmas.find(va);
+    if ((found == nullptr) || (found->prot == 0) ||
+            (write && !(found->prot & VMA::WRITE))) {
+        Process::enable();
+        return false;
+    }
+    /* the pager may block, work from a copy */
+    VMA a = *found;
+    Process::enable();
+
+    uint32_t page = va & 0xfffff000;
+    bool writable = (a.prot & VMA::WRITE) != 0;
+    /* writes to a shared area go to the pager's frames */
+    bool shared = (a.flags & VMA::SHARED) != 0;
+
+    uint32_t pte = entry(page);
+    if (Swap::isSwapped(pte)) {
+        Swap::in(this,page);
+        return true;
+    }
+    if (pte & P) {
+        if (write && (pte & COW)) {
+            copyOnWrite(page,pte);
+        }
+        return true;
+    }
+    if ((a.flags & VMA::LARGE) && faultLarge(va,a)) {
+        return true;
+    }
+
+    /* the aligned cluster around va, inside the area */
+    uint32_t window = FAULT_AROUND * PhysMem::FRAME_SIZE;
+    uint32_t from = va & ~(window - 1);
+    uint32_t to = from + window;
+    if (from < a.start) from = a.start;
+    if (to > a.end) to = a.end;
+
+    for (uint32_t p = from; p < to; p += PhysMem::FRAME_SIZE) {
+        /* present or swapped out */
+        if (entry(p) != 0) continue;
+        uint32_t frame = 0;
+        if (a.pager != nullptr) {
+            frame = a.pager->page(a.offsetOf(p) / PhysMem::FRAME_SIZE);
+            if (frame == 0) {
+                /* past the end of the file */
+                if (p == page) return false;
+                continue;
+            }
         }
+        /* a private page that's going to be written right away gets its
+           own frame now, memory is only spent on pages that get written */
+        uint32_t copy = 0;
+        if (write && (p == page) && !shared) {
+            copy = PhysMem::alloc();
+            if (frame != 0) memcpy((void*) copy,(void*) frame,PhysMem::FRAME_SIZE);
+        }
+
+        Process::disable();
+        /* the pager and alloc may block, another thread may have unmapped,
+           protected or faulted in the page meanwhile */
+        VMA* now = vmas.find(p);
+        bool still = (now != nullptr) && (now->pager == a.pager) && (now->prot == a.prot) &&
+            (now->offsetOf(p) == a.offsetOf(p)) && (entry(p) == 0);
+        if (still) {
+            if (copy != 0) {
+                pmap(p,copy,true,true);
+                copy = 0;
+            } else if (frame == 0) {
+                mapZero(p);
+            } else if (shared) {
+                set(p,frame | CACHED | U | (writable ? W : 0) | P);
+            } else {
+                /* shared with the pager until someone writes */
+                set(p,frame | CACHED | COW | U | P);
+            }
+        }
+        Process::enable();
+        if (copy != 0) PhysMem::free(copy);
     }
+    return true;
+}
+
+bool AddressSpace::faultLarge(uint32_t va, const VMA& area) {
+    uint32_t base = va & ~(PhysMem::LARGE_SIZE - 1);
+    uint32_t i0 = va >> 22;
+    if ((base < area.start) || (area.end - base < PhysMem::LARGE_SIZE) || (pd[i0] != 0)) {
+        /* it doesn't cover the 4MB, or some of it is already mapped */
+        return false;
+    }
+    uint32_t frame = PhysMem::allocLarge();
+    if (frame == 0) return false;
 
-    pmap(va,PhysMem::alloc(),true,true);
-    return va;
+    Process::disable();
+    /* another thread may have mapped something here meanwhile */
+    bool mine = (pd[i0] == 0);
+    if (mine) {
+        pd[i0] = frame | LARGE | U | ((area.prot & VMA::WRITE) ? W : 0) | P;
+        invlpg(base);
+    }
+    Process::enable();
+    if (mine) {
+        largeMaps.getThenAdd(1);
+        resident.getThenAdd(PhysMem::LARGE_SIZE / PhysMem::FRAME_SIZE);
+    } else {
+        PhysMem::freeLarge(frame);
+    }
+    return true;
 }
 
 void AddressSpace::activate() {
@@ -151,68 +752,207 @@ void AddressSpace::activate() {
     Process::enable();
 }
 
-void AddressSpace::handlePageFault(regs *context, uint32_t va) {
+// send SIGSEGV, the handler runs on the way back to user space.
+// Without one the access would just fault again.
+static void segv(bool user) {
+    Process* me = Process::current;
+    if (!user || me->isSignalBlocked(SIGSEGV) ||
+            (me->getSignalAction(SIGSEGV) != HANDLE)) {
+        me->kill(SIGSEGV);
+    } else {
+        me->signal(SIGSEGV);
+    }
+}
+
+void AddressSpace::handlePageFault(regs *context, uint32_t va, bool user, bool write) {
     //Process::trace("page fault @ %x",va);
     if (va < 0x1000) {
         Debug::printf("process %s %d, page fault %x\n",Process::current->name, Process::current->id,va);
         Process::current->kill(ERR_PAGE_FAULT);
     } else {
+        if (va >= KernelMemory::USER_BASE) {
+            Swap::reclaim();
+            /* the kernel faulting on user memory (a read into a big
+               buffer) may be holding locks, it isn't killed here */
+            Oom::check(user);
+        }
         if (va >= 0x80000000) {
-            pmap(va,PhysMem::alloc(),true,true);
-        } else if(va >= 0x400000) {
-            // send SIGSEGV if in the right portion of memory
-            // this will return us to user space
-            Process::current->inSignal = true;
-            Process::current->iDepth++;
-            Signal(SIGSEGV).doSignal();
+            uint32_t pte = entry(va);
+            if ((va >= pageUp(heapEnd)) && (va < STACK_BOTTOM)) {
+                // between the break and the stack
+                segv(user);
+            } else if (Swap::isSwapped(pte)) {
+                Swap::in(this,va);
+            } else if (pte & P) {
+                if (write && (pte & COW)) {
+                    copyOnWrite(va & 0xfffff000,pte);
+                } else if (write && !(pte & W)) {
+                    // writing the program text
+                    segv(user);
+                }
+                // otherwise another thread mapped it meanwhile, the
+                // access is allowed now and just runs again
+            } else if (write) {
+                pmap(va,PhysMem::alloc(),true,true);
+            } else {
+                mapZero(va & 0xfffff000);
+            }
+        } else if (user && (va < KernelMemory::USER_BASE)) {
+            // kernel memory, a handler can't fix that
+            Process::current->kill(SIGSEGV);
+        } else if(va >= KernelMemory::USER_BASE) {
+            if (!faultIn(va,write)) {
+                segv(user);
+            }
         } else {
             Debug::panic("process %s %d, page fault %x\n",Process::current->name, Process::current->id,va);
         }
     }
 }
 
-void AddressSpace::fork(AddressSpace* child) {
-    for (int i0 = 512; i0 < 1024; i0++) {
+static bool usable(uint32_t pte, bool write) {
+    uint32_t need = write ? (AddressSpace::P | AddressSpace::U | AddressSpace::W) :
+        (AddressSpace::P | AddressSpace::U);
+    return (pte & need) == need;
+}
+
+bool AddressSpace::present(uint32_t start, uint32_t end, bool write) {
+    if (start >= end) return true;
+    // the stack is in the last page, counting up to end would wrap
+    uint32_t last = (end - 1) & 0xfffff000;
+    for (uint32_t va = start & 0xfffff000; ; va += PhysMem::FRAME_SIZE) {
+        if ((va < KernelMemory::USER_BASE) || !usable(entry(va),write)) return false;
+        if (va == last) return true;
+    }
+}
+
+void AddressSpace::prefault(uint32_t start, uint32_t end, bool write) {
+    if (start >= end) return;
+    uint32_t last = (end - 1) & 0xfffff000;
+    for (uint32_t va = start & 0xfffff000; ; va += PhysMem::FRAME_SIZE) {
+        uint32_t pte = entry(va);
+        if ((va < KernelMemory::USER_BASE) || ((pte & P) && !(pte & U))) {
+            // kernel memory, or a page the user can't touch
+            Process::current->kill(SIGSEGV);
+        }
+        if (!usable(pte,write)) {
+            handlePageFault(nullptr,va,false,write);
+        }
+        if (va == last) return;
+    }
+}
+
+bool AddressSpace::fork(AddressSpace* child) {
+    child->heapStart = heapStart;
+    child->heapEnd = heapEnd;
+    Process::disable();
+    child->vmas.copyFrom(&vmas);
+    Process::enable();
+    for (int i0 = 0; i0 < 1024; i0++) {
+        if (!userPDE(i0)) continue;
         uint32_t pde = pd[i0];
+        if (pde & LARGE) {
+            /* a large copy, or if there isn't room split ours and copy it
+               4K at a time below, with reclaim between the pages */
+            uint32_t dest = PhysMem::allocLarge();
+            bool copied = false;
+            Process::disable();
+            pde = pd[i0];
+            if ((pde & LARGE) && (dest != 0)) {
+                memcpy((void*)dest,(void*)(pde & 0xffc00000),PhysMem::LARGE_SIZE);
+                child->pd[i0] = dest | (pde & (LARGE | U | W | P));
+                child->resident.getThenAdd(PhysMem::LARGE_SIZE / PhysMem::FRAME_SIZE);
+                dest = 0;
+                copied = true;
+            } else if (pde & LARGE) {
+                split(i0);
+            }
+            Process::enable();
+            if (dest != 0) PhysMem::freeLarge(dest);
+            /* split, here or by another thread, look again */
+            if (!copied) i0 --;
+            continue;
+        }
         if (pde & P) {
             uint32_t *pt = (uint32_t*) (pde & 0xfffff000);
             uint32_t high = i0 << 22;
             for (uint32_t i1 = 0; i1 < 1024; i1++) {
+                if (pt[i1] == 0) continue;
+                uint32_t va = high | (i1 << 12);
+                Swap::reclaim();
+                if (PhysMem::freeFrames() < Oom::RESERVE) {
+                    /* the reserve is for the kernel, not for copies */
+                    return false;
+                }
+                if (Swap::isSwapped(pt[i1])) {
+                    /* the child gets a copy in memory */
+                    Swap::in(this,va);
+                }
+                Process::disable();
+                if ((pd[i0] & 0xfffff000) != (uint32_t) pt) {
+                    /* unmapped by another thread */
+                    Process::enable();
+                    break;
+                }
                 uint32_t pte = pt[i1];
-                if (pte & P) {
-                    uint32_t va = high | (i1 << 12);
+                if (Swap::isSwapped(pte)) {
+                    /* swapped out again before we got here, try again */
+                    Process::enable();
+                    i1 --;
+                    continue;
+                }
+                if (pte & CACHED) {
+                    /* both keep using the pager's frame */
+                    child->getPTE(va) = pte & (0xfffff000 | CACHED | COW | U | W | P);
+                } else if ((pte & (COW | P)) == (COW | P)) {
+                    /* and a merged one */
+                    child->getPTE(va) = pte & (0xfffff000 | COW | U | P);
+                    Merge::get(pte & 0xfffff000);
+                } else if (pte & P) {
+                    /* copied before swap can take the frame */
                     uint32_t src = pte & ~0xfff;
                     uint32_t dest = PhysMem::alloc();
                     memcpy((void*)dest,(void*)src,PhysMem::FRAME_SIZE);
-                    child->pmap(va,dest,true,true);
+                    child->pmap(va,dest,(pte & U) != 0,(pte & W) != 0);
                 }
+                Process::enable();
             }
         }
     }
+    return true;
 }
 
 void AddressSpace::exec() {
-    for (int i0 = 512; i0 < 1024; i0++) {
-        uint32_t pde = pd[i0];
-        if (pde & P) {
-            uint32_t *pt = (uint32_t*) (pde & 0xfffff000);
-            uint32_t high = i0 << 22;
-            for (uint32_t i1 = 0; i1 < 1024; i1++) {
-                uint32_t pte = pt[i1];
-                if (pte & P) {
-                    uint32_t va = high | (i1 << 12);
-                    uint32_t pa = pte & ~0xfff;
-                    pt[i1] = 0;
-                    invlpg(va);
-                    PhysMem::free(pa);
-                }
-            }
-        }
-    }
+    heapStart = 0x80000000;
+    heapEnd = 0x80000000;
+    clear();
+}
+
+void AddressSpace::clear() {
+    Process::disable();
+    vmas.clear();
+    Process::enable();
+    dropAll();
+}
+
+uint32_t AddressSpace::brk(uint32_t adr) {
+    if ((adr < heapStart) || (adr > STACK_BOTTOM)) return heapEnd;
+    uint32_t from = pageUp(adr);
+    uint32_t to = pageUp(heapEnd);
+
+    /* give back the pages above the new break, and flush them before
+       the range can be grown into again */
+    unmapRange(from,to);
+    heapEnd = adr;
+    /* anything another thread faulted in meanwhile */
+    unmapRange(from,to);
+    return heapEnd;
 }
 
 extern "C" void vmm_pageFault(regs *context, uintptr_t va) {
     //Process::trace("page fault: eip=%X", context[10]);
+    if (KernelMemory::syncFault(va)) return;
+
     Process* proc = Process::current;
     if (!proc) {
         for (int i=0; i<20; i++) {
@@ -220,10 +960,10 @@ extern "C" void vmm_pageFault(regs *context, uintptr_t va) {
         }
         Debug::panic("page fault @ 0x%08x without current process",va);
     }
-    // trap frame also contains the trap number: 6
+    // the trap frame starts with the error code
     // so everything is shifted over one word
     struct trapFrame {
-        uint32_t trapNum;
+        uint32_t error;
         uint32_t eip;
         uint32_t cs;
         uint32_t flags;
@@ -231,14 +971,22 @@ extern "C" void vmm_pageFault(regs *context, uintptr_t va) {
         uint32_t ss;
     } *trapFrame = (struct trapFrame*)&context->eip;
 
-    // if we came from user-space, save the context
-    if (trapFrame->eip >= 0x80000000) {
-        *proc->context->registers = *context;
-        proc->context->registers->eip = trapFrame->eip;
-        proc->context->registers->cs = trapFrame->cs;
-        proc->context->registers->flags = trapFrame->flags;
-        proc->context->registers->esp = trapFrame->esp;
-        proc->context->registers->ss = trapFrame->ss;
+    bool user = trapFrame->eip >= 0x80000000;
+    if (!user && KernelStack::isGuard(va)) {
+        Debug::panic("kernel stack overflow in %s#%d @ 0x%08x",proc->name,proc->id,va);
+    }
+    bool write = (trapFrame->error & 2) != 0;
+    proc->addressSpace->handlePageFault(context,va,user,write);
+
+    // going back to user space, deliver signals first
+    if (user && (proc->deliverableSignals() != 0)) {
+        regs registers = *context;
+        registers.eip = trapFrame->eip;
+        registers.cs = trapFrame->cs;
+        registers.flags = trapFrame->flags;
+        registers.esp = trapFrame->esp;
+        registers.ss = trapFrame->ss;
+
+        Signal::checkSignals(&registers);
     }
-    proc->addressSpace.handlePageFault(context,va);
 }
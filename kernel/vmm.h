@@ -3,6 +3,9 @@
 
 #include "stdint.h"
 #include "signal.h"
+#include "resource.h"
+#include "vma.h"
+#include "atomic.h"
 
 // The physical memory interface
 class PhysMem {
@@ -12,37 +15,239 @@ class PhysMem {
         Node* next;
     };
     static Node *firstFree;
+    static uint32_t nFree;
+    /* free 4MB blocks, kept whole for large pages */
+    static Node *firstLarge;
+    static uint32_t nLarge;
 public:
     static constexpr uint32_t FRAME_SIZE = (1 << 12);
+    static constexpr uint32_t LARGE_SIZE = (1 << 22);
+
+    /* frames to free together, linked through themselves */
+    class FrameList {
+        friend class PhysMem;
+        Node* head;
+        Node* tail;
+        uint32_t n;
+    public:
+        FrameList() : head(nullptr), tail(nullptr), n(0) {}
+        void add(uint32_t frame);
+        uint32_t size() const { return n; }
+    };
     static uint32_t limit;
     static void init(uint32_t start, uint32_t end);
 
+    /* the end of physical memory, from the CMOS */
+    static uint32_t probe();
+
     /* allocate a frame */
     static uint32_t alloc();
 
     /* free a frame */
     static void free(uint32_t);
+
+    /* free all of them in one go */
+    static void free(FrameList& list);
+
+    /* 4MB of contiguous, 4MB aligned frames, 0 if there aren't any.
+       Frames are only split off a free block when nothing else is left */
+    static uint32_t allocLarge();
+
+    /* free a block from allocLarge, its frames can also be freed one
+       at a time */
+    static void freeLarge(uint32_t);
+
+    /* how many frames alloc can still hand out */
+    static uint32_t freeFrames();
 };
 
-class AddressSpace {
+/*
+ * Kernel virtual memory, the same in every address space.
+ *
+ *    [0,PHYS_END)                  physical memory, identity mapped
+ *    [HEAP_BASE,HEAP_END)          the kernel heap, grows by pages
+ *    [VMALLOC_BASE,VMALLOC_END)    large kernel allocations
+ *    [USER_BASE,KernelStack::BASE) user mmap
+ *    [KernelStack::BASE,END)       kernel stacks
+ *    [0x80000000,...)              user program and stack
+ *
+ * The page tables for the kernel parts are shared. They are built in
+ * the kernel page directory and copied into an address space when it
+ * is created; a table added later is picked up by the first fault on
+ * it, kernel page tables are never freed.
+ */
+class KernelMemory {
+public:
+    static constexpr uint32_t PHYS_END = 0x30000000;
+    static constexpr uint32_t HEAP_BASE = 0x30000000;
+    static constexpr uint32_t HEAP_END = 0x38000000;
+    static constexpr uint32_t VMALLOC_BASE = 0x38000000;
+    static constexpr uint32_t VMALLOC_END = 0x40000000;
+    static constexpr uint32_t USER_BASE = 0x40000000;
+
+    /* build the kernel page directory and turn paging on */
+    static void init();
+
+    /* share the kernel page tables with a new page directory */
+    static void mapInto(uint32_t* pd);
+
+    /* a kernel page at va */
+    static void map(uint32_t va, uint32_t pa);
+
+    /* returns the frame that was mapped at va, 0 if none */
+    static uint32_t unmap(uint32_t va);
+
+    /* fault on a kernel table the current directory doesn't have yet,
+       true if it was copied in */
+    static bool syncFault(uint32_t va);
+};
+
+class AddressSpace;
+
+/*
+ * Unmapping a lot of pages at once, for exec, exit and munmap.
+ *
+ * The caller takes entries, whole page tables and large pages out of
+ * the address space and hands them over. Until they are flushed the
+ * TLB may still reach their frames, so nothing is let go before then.
+ * A flush invalidates the few pages it has one at a time, or reloads
+ * CR3 once when there are more of them (nothing to do if the address
+ * space isn't the one in use), then releases what they held and gives
+ * the private frames back to PhysMem in one critical section.
+ *
+ * It flushes by itself when it runs out of room, and when it goes away.
+ */
+class UnmapBatch {
+    static constexpr uint32_t PAGES = 32;
+    static constexpr uint32_t TABLES = 8;
+    /* more pages than this and reloading CR3 is cheaper */
+    static constexpr uint32_t INVLPG_MAX = 8;
+
+    AddressSpace* space;
+    uint32_t nPages;
+    uint32_t nTables;
+    uint32_t nBlocks;
+    uint32_t vas[PAGES];
+    uint32_t ptes[PAGES];
+    uint32_t* tables[TABLES];
+    uint32_t blocks[TABLES];
+public:
+    explicit UnmapBatch(AddressSpace* space) :
+        space(space), nPages(0), nTables(0), nBlocks(0) {}
+    ~UnmapBatch() { flush(); }
+
+    /* the entry that was at va */
+    void page(uint32_t va, uint32_t pte);
+    /* a page table that is out of the directory, with its entries */
+    void table(uint32_t* pt);
+    /* a large page that is out of the directory */
+    void large(uint32_t frame);
+
+    void flush();
+};
+
+/* shared by all the threads of a process */
+class AddressSpace : public Resource {
+    friend class UnmapBatch;
     uint32_t *pd;
+    /* the user mmap areas */
+    VMAList vmas;
 private:
     uint32_t& getPTE(uint32_t va);
+    /* unmap the pages in [start,end) and free their frames */
+    void unmapRange(uint32_t start, uint32_t end);
+    /* resolve a fault in the mmap region, false if it's not allowed */
+    bool faultIn(uint32_t va, bool write);
+    /* map the zero frame at va until it is written */
+    void mapZero(uint32_t va);
+    /* a write to a copy on write page, give it a frame of its own */
+    void copyOnWrite(uint32_t va, uint32_t pte);
+    /* map the 4MB around va with one large page, false if it can't */
+    bool faultLarge(uint32_t va, const VMA& area);
+    /* turn the large page at pd[i0] into a table of its 4K frames */
+    void split(uint32_t i0);
+    /* point the entry for va at something new */
+    void set(uint32_t va, uint32_t pte);
+    /* take every user mapping out, for exec and the destructor */
+    void dropAll();
 public:
     static constexpr uint32_t P = 1;
     static constexpr uint32_t W = 2;
     static constexpr uint32_t U = 4;
+    /* software bits: the frame belongs to a pager (the page cache or a
+       shared memory segment), and it is copied before it's written.
+       COW without CACHED is a frame shared by merging (see Merge) */
+    static constexpr uint32_t CACHED = 0x200;
+    static constexpr uint32_t COW = 0x400;
+    /* not present, the page is in the swap slot in the frame bits */
+    static constexpr uint32_t SWAPPED = 0x800;
+    /* set by the MMU when the page is used */
+    static constexpr uint32_t ACCESSED = 0x20;
+    /* a directory entry that maps 4MB of private anonymous memory
+       itself, swap and merging never see its frames */
+    static constexpr uint32_t LARGE = 0x80;
+
+    /* a fault in an area maps up to this many pages around it */
+    static constexpr uint32_t FAULT_AROUND = 8;
+
+    /* every anonymous page that has only been read maps this frame */
+    static uint32_t zeroFrame;
+    /* pages mapped to the zero frame, and the ones written later */
+    static Atomic32 zeroHits;
+    static Atomic32 zeroCopies;
+    /* the CPU has 4MB pages, how many were mapped and later split */
+    static bool largePages;
+    static Atomic32 largeMaps;
+    static Atomic32 largeSplits;
+    static void report();
+
+    /* the stack can grow down to here */
+    static constexpr uint32_t STACK_BOTTOM = 0xf0000000;
+
+    /* the heap runs from the end of the program to the break */
+    uint32_t heapStart;
+    uint32_t heapEnd;
+
+    /* private frames mapped (not the ones that belong to a pager, are
+       merged or swapped out), and page table frames with the directory */
+    Atomic32 resident;
+    Atomic32 tables;
 
     AddressSpace();
     virtual ~AddressSpace();
     void punmap(uint32_t va);
+    /* the physical address va maps to, 0 if not mapped */
+    uint32_t physical(uint32_t va);
+    /* the page table entry for va, 0 if there isn't one */
+    uint32_t entry(uint32_t va);
+    /* where it lives, nullptr if there is no page table for va */
+    uint32_t* pteOf(uint32_t va);
     void pmap(uint32_t va, uint32_t pa, bool forUser, bool forWrite);
-    long mmap(uint32_t va);
+    /* map a pager's frame read only, e.g. program text from the cache */
+    void share(uint32_t va, uint32_t frame);
+    /* add an area, anonymous memory unless there is a pager, returns
+       its address */
+    long mmap(uint32_t addr, uint32_t len, uint32_t prot, uint32_t flags,
+        Pager* pager = nullptr, uint32_t offset = 0);
+    long munmap(uint32_t addr, uint32_t len);
+    long mprotect(uint32_t addr, uint32_t len, uint32_t prot);
     void activate();
-    void handlePageFault(regs *context, uint32_t va);
+    void handlePageFault(regs *context, uint32_t va, bool user, bool write);
+    /* can the kernel touch [start,end) for the user without faulting,
+       precondition: disabled so it stays that way */
+    bool present(uint32_t start, uint32_t end, bool write);
+    /* fault [start,end) in the way the user would touch it, kills the
+       process with SIGSEGV if the user can't */
+    void prefault(uint32_t start, uint32_t end, bool write);
     void dump();
-    void fork(AddressSpace *child);
+    /* copy into child, false if memory ran out part way (the caller
+       throws the child away) */
+    bool fork(AddressSpace *child);
     void exec(); /* prepare for exec */
+    /* drop all the user memory, the last thread is exiting */
+    void clear();
+    /* move the break to adr, returns where it ends up */
+    uint32_t brk(uint32_t adr);
 };
 
 #endif
@@ -0,0 +1,287 @@
+#include "zram.h"
+#include "vmm.h"
+#include "process.h"
+#include "machine.h"
+#include "debug.h"
+
+#define PAGE 4096
+#define CLASSES (Zram::MAX_SIZE / Zram::GRAIN)
+
+/* the coder */
+#define MIN_MATCH 3
+#define MAX_MATCH (MIN_MATCH + 15)
+#define HASH_BITS 12
+
+/* a slab, one frame of objects of one size */
+struct Slab {
+    Slab* next;         /* in partial[], while it has room */
+    Slab* prev;
+    uint32_t frame;
+    uint32_t freeList;  /* the first free object, they link through */
+    uint32_t inUse;
+    uint32_t cls;
+};
+
+/* what a handle stands for */
+struct Entry {
+    uint32_t data;      /* the object, the fill word, or the next free entry */
+    Slab* slab;         /* nullptr for a page of one repeated word */
+    uint32_t size;
+};
+
+/* slabs with a free object, by size class */
+static Slab* partial[CLASSES];
+
+/* descriptors for the most slabs there can be, so making a slab
+   doesn't need the heap */
+static Slab* spareSlabs = nullptr;
+
+static Entry* entries = nullptr;
+static uint32_t nEntries = 0;
+static uint32_t freeEntry = 0;
+
+static uint32_t poolFrames = 0;
+static uint32_t poolLimit = 0;
+
+/* counters */
+static uint32_t pages = 0;
+static uint32_t filled = 0;
+static uint32_t bytes = 0;
+static uint32_t stores = 0;
+static uint32_t rejects = 0;
+
+/* compressor state and output, we only ever run one at a time */
+static uint16_t table[1 << HASH_BITS];
+static uint8_t scratch[Zram::MAX_SIZE];
+
+void Zram::init(uint32_t nFrames) {
+    /* compressed pages can outnumber frames */
+    nEntries = 2 * nFrames;
+    if (nEntries > (1 << 19)) nEntries = 1 << 19;
+    entries = new Entry[nEntries];
+    /* handle 0 means none, the rest are free */
+    for (uint32_t i = 1; i < nEntries; i++) {
+        entries[i].data = (i + 1 < nEntries) ? i + 1 : 0;
+        entries[i].slab = nullptr;
+        entries[i].size = 0;
+    }
+    freeEntry = 1;
+    for (uint32_t c = 0; c < CLASSES; c++) partial[c] = nullptr;
+    poolLimit = nFrames / 4;
+    Slab* all = new Slab[poolLimit];
+    for (uint32_t i = 0; i < poolLimit; i++) {
+        all[i].next = spareSlabs;
+        spareSlabs = &all[i];
+    }
+}
+
+static inline uint32_t hash(const uint8_t* p) {
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* LZ77, returns the compressed size, 0 if it doesn't fit in max */
+static uint32_t compress(const uint8_t* in, uint8_t* out, uint32_t max) {
+    for (uint32_t i = 0; i < (1 << HASH_BITS); i++) table[i] = 0;
+
+    uint32_t i = 0;
+    uint32_t o = 0;
+    while (i < PAGE) {
+        /* a flag byte and up to 8 items of at most 2 bytes */
+        if (o + 17 > max) return 0;
+        uint32_t flagAt = o++;
+        uint8_t flags = 0;
+        for (uint32_t bit = 0; (bit < 8) && (i < PAGE); bit++) {
+            uint32_t len = 0;
+            uint32_t dist = 0;
+            if (i + MIN_MATCH <= PAGE) {
+                uint32_t h = hash(&in[i]);
+                uint32_t at = table[h];
+                table[h] = i + 1;
+                if (at != 0) {
+                    at --;
+                    dist = i - at;
+                    uint32_t most = PAGE - i;
+                    if (most > MAX_MATCH) most = MAX_MATCH;
+                    while ((len < most) && (in[at + len] == in[i + len])) len++;
+                }
+            }
+            if (len >= MIN_MATCH) {
+                /* distances are less than a page, 12 bits */
+                flags |= 1 << bit;
+                out[o++] = dist & 0xff;
+                out[o++] = ((dist >> 8) << 4) | (len - MIN_MATCH);
+                i += len;
+            } else {
+                out[o++] = in[i++];
+            }
+        }
+        out[flagAt] = flags;
+    }
+    return o;
+}
+
+static void decompress(const uint8_t* in, uint8_t* out) {
+    uint32_t i = 0;
+    uint32_t o = 0;
+    while (o < PAGE) {
+        uint8_t flags = in[i++];
+        for (uint32_t bit = 0; (bit < 8) && (o < PAGE); bit++) {
+            if (flags & (1 << bit)) {
+                uint32_t dist = in[i] | ((in[i + 1] >> 4) << 8);
+                uint32_t len = (in[i + 1] & 15) + MIN_MATCH;
+                i += 2;
+                /* byte by byte, a match can overlap itself */
+                for (uint32_t k = 0; k < len; k++, o++) out[o] = out[o - dist];
+            } else {
+                out[o++] = in[i++];
+            }
+        }
+    }
+}
+
+/* precondition: disabled */
+static void unlinkSlab(Slab* s) {
+    if (s->prev) s->prev->next = s->next; else partial[s->cls] = s->next;
+    if (s->next) s->next->prev = s->prev;
+    s->next = nullptr;
+    s->prev = nullptr;
+}
+
+/* precondition: disabled */
+static void pushSlab(Slab* s) {
+    s->prev = nullptr;
+    s->next = partial[s->cls];
+    if (s->next) s->next->prev = s;
+    partial[s->cls] = s;
+}
+
+/* precondition: disabled. An object of class cls, 0 if the pool is full */
+static uint32_t allocObject(uint32_t cls, Slab** from) {
+    Slab* s = partial[cls];
+    if (s == nullptr) {
+        if ((poolFrames >= poolLimit) || (PhysMem::freeFrames() == 0)) return 0;
+        uint32_t size = (cls + 1) * Zram::GRAIN;
+        s = spareSlabs;
+        spareSlabs = s->next;
+        s->frame = PhysMem::alloc();
+        s->inUse = 0;
+        s->cls = cls;
+        s->freeList = 0;
+        for (uint32_t at = PAGE / size; at > 0; at--) {
+            uint32_t obj = s->frame + (at - 1) * size;
+            *((uint32_t*) obj) = s->freeList;
+            s->freeList = obj;
+        }
+        poolFrames ++;
+        pushSlab(s);
+    }
+    uint32_t obj = s->freeList;
+    s->freeList = *((uint32_t*) obj);
+    s->inUse ++;
+    if (s->freeList == 0) unlinkSlab(s);
+    *from = s;
+    return obj;
+}
+
+/* precondition: disabled */
+static void freeObject(Slab* s, uint32_t obj) {
+    if (s->freeList == 0) pushSlab(s);
+    *((uint32_t*) obj) = s->freeList;
+    s->freeList = obj;
+    s->inUse --;
+    if (s->inUse == 0) {
+        unlinkSlab(s);
+        PhysMem::free(s->frame);
+        s->next = spareSlabs;
+        spareSlabs = s;
+        poolFrames --;
+    }
+}
+
+uint32_t Zram::store(uint32_t frame) {
+    if (entries == nullptr) return 0;
+    const uint32_t* words = (const uint32_t*) frame;
+
+    Process::disable();
+    uint32_t handle = freeEntry;
+    if (handle == 0) {
+        Process::enable();
+        return 0;
+    }
+    Entry* e = &entries[handle];
+    stores ++;
+
+    /* a page of one repeated word, zeros most of the time */
+    uint32_t w = 1;
+    while ((w < PAGE / 4) && (words[w] == words[0])) w++;
+    if (w == PAGE / 4) {
+        freeEntry = e->data;
+        e->data = words[0];
+        e->slab = nullptr;
+        e->size = 0;
+        pages ++;
+        filled ++;
+        Process::enable();
+        return handle;
+    }
+
+    uint32_t size = compress((const uint8_t*) frame,scratch,MAX_SIZE);
+    Slab* slab = nullptr;
+    uint32_t obj = (size == 0) ? 0 : allocObject((size - 1) / GRAIN,&slab);
+    if (obj == 0) {
+        rejects ++;
+        Process::enable();
+        return 0;
+    }
+    memcpy((void*) obj,scratch,size);
+    freeEntry = e->data;
+    e->data = obj;
+    e->slab = slab;
+    e->size = size;
+    pages ++;
+    bytes += size;
+    Process::enable();
+    return handle;
+}
+
+void Zram::load(uint32_t handle, uint32_t frame) {
+    Process::disable();
+    Entry* e = &entries[handle];
+    if (e->slab == nullptr) {
+        uint32_t* words = (uint32_t*) frame;
+        for (uint32_t w = 0; w < PAGE / 4; w++) words[w] = e->data;
+    } else {
+        decompress((const uint8_t*) e->data,(uint8_t*) frame);
+    }
+    free(handle);
+    Process::enable();
+}
+
+void Zram::free(uint32_t handle) {
+    Process::disable();
+    Entry* e = &entries[handle];
+    if (e->slab == nullptr) {
+        filled --;
+    } else {
+        freeObject(e->slab,e->data);
+        bytes -= e->size;
+    }
+    pages --;
+    e->slab = nullptr;
+    e->size = 0;
+    e->data = freeEntry;
+    freeEntry = handle;
+    Process::enable();
+}
+
+void Zram::report() {
+    if (entries == nullptr) return;
+    /* in tenths, of the pages that were compressed: the filled ones
+       take no space and would inflate it */
+    uint32_t kb = bytes / 1024;
+    uint32_t ratio = (kb == 0) ? 0 : ((pages - filled) * (PhysMem::FRAME_SIZE / 1024) * 10) / kb;
+    Debug::printf("zram: %d pages (%d of one word) in %d frames, %d bytes compressed, %d.%dx\n",
+        pages,filled,poolFrames,bytes,ratio / 10,ratio % 10);
+    Debug::printf("zram: %d pages offered, %d didn't compress\n",stores,rejects);
+}
@@ -0,0 +1,43 @@
+#ifndef _ZRAM_H_
+#define _ZRAM_H_
+
+#include "stdint.h"
+
+/*
+ * Compressed pages in memory, the first place swap puts a page.
+ *
+ * A page is compressed with a small LZ77 coder (a flag bit per item,
+ * an item is a literal byte or a 12 bit distance and a 4 bit length)
+ * into a pool of slabs. Each slab is one frame cut into objects of one
+ * size class, a multiple of 64 bytes, so a page that shrinks to 900
+ * bytes takes 960. Pages filled with one repeated word take no space
+ * at all, only their handle. Pages that don't shrink to 3KB are left
+ * for the swap drive, and the pool stops growing at a quarter of
+ * memory.
+ *
+ * Everything runs with interrupts disabled and never blocks, so the
+ * idle process can compress pages too.
+ */
+class Zram {
+public:
+    /* object sizes are multiples of this */
+    static constexpr uint32_t GRAIN = 64;
+    /* a page has to compress to this to be worth keeping */
+    static constexpr uint32_t MAX_SIZE = 3072;
+
+    static void init(uint32_t nFrames);
+
+    /* compress a page, returns its handle, 0 if it didn't fit */
+    static uint32_t store(uint32_t frame);
+
+    /* decompress the page into the frame and let the handle go */
+    static void load(uint32_t handle, uint32_t frame);
+
+    /* the page isn't needed anymore */
+    static void free(uint32_t handle);
+
+    /* print the counters */
+    static void report();
+};
+
+#endif
@@ -15,9 +15,7 @@ int main(int argc, char** argv) {
                     puts("error reading : "); puts(argv[i]); puts("\n");
                     break;
                 }
-                for (int j = 0; j < n; j++) {
-                    putchar(buf[j]);
-                }
+                write(STDOUT,buf,n);
             }
         }
         close(fd);
@@ -1,218 +1,307 @@
 #include "libc.h"
 
-/* A first-fit heap */
-
-#define INTS 0x100000
-
-static int array[INTS];
-static int len = INTS;
-static int safe = 1;
-static int avail = 0;
-
-static void makeTaken(int i, int ints);
-static void makeAvail(int i, int ints);
-
-void heap_init() {
-    makeTaken(0,2);
-    makeAvail(2,len-4);
-    makeTaken(len-2,2);
+/*
+ * A segregated-fit heap on top of brk.
+ *
+ * Every chunk has its size in a header word before it and a footer
+ * word at its end, with the low bit set while it is in use, so free
+ * neighbors can be merged. Free chunks sit in bins by size: one bin per
+ * size (in steps of 8 bytes) for small chunks, one per power of two
+ * above that. A bitmap says which bins have anything in them.
+ *
+ * The heap grows with brk and gives a large free chunk at the top back
+ * to the kernel.
+ */
+
+#define USED 1
+#define MIN_CHUNK 16
+#define SMALL 256
+#define NBINS 64
+
+/* brk at least this much at a time */
+#define GROW 0x10000
+/* give memory back when the top chunk gets this big, keep some */
+#define TRIM 0x40000
+#define KEEP 0x10000
+
+typedef struct chunk {
+    unsigned long head;         /* size | USED */
+    struct chunk* next;         /* in its bin, only while free */
+    struct chunk* prev;
+} chunk;
+
+static chunk* bins[NBINS];
+static unsigned long binMap[NBINS / 32];
+
+/* the last word of the heap, a used chunk of size 0 */
+static unsigned long* top;
+
+/* threads share the heap */
+static mutex_t lock;
+
+static inline unsigned long chunkSize(chunk* c) {
+    return c->head & ~USED;
 }
 
-static int abs(int x) {
-    if (x < 0) return -x; else return x;
+static inline int isUsed(chunk* c) {
+    return c->head & USED;
 }
 
-static int size(int i) {
-    return abs(array[i]);
+static inline unsigned long* footer(chunk* c) {
+    return (unsigned long*) (((char*) c) + chunkSize(c) - 4);
 }
 
-static int headerFromFooter(int i) {
-    return i - size(i) + 1;
+static inline void setChunk(chunk* c, unsigned long size, unsigned long used) {
+    c->head = size | used;
+    *footer(c) = size | used;
 }
 
-static int footerFromHeader(int i) {
-    return i + size(i) - 1;
+static inline chunk* rightOf(chunk* c) {
+    return (chunk*) (((char*) c) + chunkSize(c));
 }
 
-static int sanity(int i) {
-    if (safe) {
-        if (i == 0) return 0;
-        if ((i < 0) || (i >= len)) {
-//            Debug::panic("bad header index %d\n",i);
-            return i;
-        }
-        int footer = footerFromHeader(i);
-        if ((footer < 0) || (footer >= len)) {
-//            Debug::panic("bad footer index %d\n",footer);
-            return i;
-        }
-        int hv = array[i];
-        int fv = array[footer];
-
-        if (hv != fv) {
-//            Debug::panic("bad block at %d, %d != %d\n", i, hv, fv);
-            return i;
-        }
-    }
-
-    return i;
+/* the neighbor on the left if it is free, 0 otherwise */
+static inline chunk* freeLeftOf(chunk* c) {
+    unsigned long f = ((unsigned long*) c)[-1];
+    if (f & USED) return 0;
+    return (chunk*) (((char*) c) - f);
 }
 
-static int left(int i) {
-    return sanity(headerFromFooter(i-1));
+static inline void* payload(chunk* c) {
+    return ((char*) c) + 4;
 }
 
-static int right(int i) {
-    return sanity(i + size(i));
+static inline chunk* chunkOf(void* p) {
+    return (chunk*) (((char*) p) - 4);
 }
 
-static int next1(int i) {
-    return sanity(array[i+1]);
+static int binOf(unsigned long size) {
+    if (size < SMALL) return size >> 3;
+    /* SMALL is 2^8 */
+    return 32 + (31 - __builtin_clz(size)) - 8;
 }
 
-static int prev1(int i) {
-    return sanity(array[i+2]);
+static void insert(chunk* c) {
+    int b = binOf(chunkSize(c));
+    c->prev = 0;
+    c->next = bins[b];
+    if (bins[b]) bins[b]->prev = c;
+    bins[b] = c;
+    binMap[b / 32] |= 1ul << (b % 32);
 }
 
-static void next(int i, int x) {
-    array[i+1] = x;
+static void unlink(chunk* c) {
+    int b = binOf(chunkSize(c));
+    if (c->prev) {
+        c->prev->next = c->next;
+    } else {
+        bins[b] = c->next;
+        if (bins[b] == 0) binMap[b / 32] &= ~(1ul << (b % 32));
+    }
+    if (c->next) c->next->prev = c->prev;
 }
 
-static void prev(int i, int x) {
-    array[i+2] = x;
-}
+/* a free chunk of at least size, taken out of its bin, 0 if none */
+static chunk* find(unsigned long size) {
+    int b = binOf(size);
 
-static void remove(int i) {
-    int prevIndex = prev1(i);
-    int nextIndex = next1(i);
+    /* small bins hold one size, the others need a look */
+    for (chunk* c = bins[b]; c != 0; c = c->next) {
+        if (chunkSize(c) >= size) {
+            unlink(c);
+            return c;
+        }
+    }
 
-    if (prevIndex == 0) {
-        /* at head */
-        avail = nextIndex;
-    } else {
-        /* in the middle */
-        next(prevIndex,nextIndex);
+    /* anything in a bigger bin fits */
+    for (int w = (b + 1) / 32; w < NBINS / 32; w++) {
+        unsigned long bits = binMap[w];
+        if (w == (b + 1) / 32) bits &= ~0ul << ((b + 1) % 32);
+        if (bits != 0) {
+            chunk* c = bins[w * 32 + __builtin_ctz(bits)];
+            unlink(c);
+            return c;
+        }
     }
-    if (nextIndex != 0) {
-        prev(nextIndex,prevIndex);
+    return 0;
+}
+
+/* use size bytes of c, the rest becomes a free chunk */
+static void split(chunk* c, unsigned long size) {
+    unsigned long extra = chunkSize(c) - size;
+    if (extra >= MIN_CHUNK) {
+        setChunk(c,size,USED);
+        chunk* rest = rightOf(c);
+        setChunk(rest,extra,0);
+        insert(rest);
+    } else {
+        setChunk(c,chunkSize(c),USED);
     }
 }
 
-static void makeAvail(int i, int ints) {
-    array[i] = ints;
-    array[footerFromHeader(i)] = ints;
-    next(i,avail);
-    prev(i,0);
-    if (avail != 0) {
-        prev(avail,i);
+/* merge a free chunk that isn't in a bin with its free neighbors */
+static chunk* coalesce(chunk* c) {
+    unsigned long size = chunkSize(c);
+    chunk* r = rightOf(c);
+    if (!isUsed(r)) {
+        unlink(r);
+        size += chunkSize(r);
     }
-    avail = i;
+    chunk* l = freeLeftOf(c);
+    if (l) {
+        unlink(l);
+        size += chunkSize(l);
+        c = l;
+    }
+    setChunk(c,size,0);
+    return c;
 }
 
-static void makeTaken(int i, int ints) {
-    array[i] = -ints;
-    array[footerFromHeader(i)] = -ints;
+/* add at least size bytes at the top, returns the new free chunk
+   (not in a bin) or 0 if the kernel says no */
+static chunk* grow(unsigned long size) {
+    unsigned long bytes = (size + GROW - 1) & ~(GROW - 1);
+    void* old = sbrk(bytes);
+    if (old == (void*) -1) return 0;
+
+    /* the old end marker is the new chunk's header */
+    chunk* c = (chunk*) top;
+    setChunk(c,bytes,0);
+    top = (unsigned long*) rightOf(c);
+    *top = USED;
+    return coalesce(c);
 }
 
-static int isAvail(int i) {
-    return array[i] > 0;
+/* the top chunk is free and big, give most of it back */
+static void trim(chunk* c) {
+    unsigned long release = (chunkSize(c) - KEEP) & ~0xfff;
+    if (release == 0) return;
+    unlink(c);
+    setChunk(c,chunkSize(c) - release,0);
+    top = (unsigned long*) rightOf(c);
+    *top = USED;
+    sbrk(-release);
+    insert(c);
 }
 
-static int isTaken(int i) {
-    return array[i] < 0;
+static unsigned long request(long bytes) {
+    /* room for the header and footer, 8 byte aligned */
+    unsigned long size = (bytes + 8 + 7) & ~7;
+    if (size < MIN_CHUNK) size = MIN_CHUNK;
+    return size;
 }
 
-void* malloc(long bytes) {
-    //Debug::printf("malloc(%d)\n",bytes);
-    if (bytes == 0) return (void*) array;
+void heap_init() {
+    mutex_init(&lock);
+    for (int i = 0; i < NBINS; i++) bins[i] = 0;
+    for (int i = 0; i < NBINS / 32; i++) binMap[i] = 0;
+
+    /* a used footer on the left and the end marker, payloads are
+       8 byte aligned */
+    char* base = (char*) brk(0);
+    char* start = (char*) ((((unsigned long) base) + 7) & ~7);
+    brk(start + 8);
+    ((unsigned long*) start)[0] = USED;
+    top = &((unsigned long*) start)[1];
+    *top = USED;
+}
 
-    int ints = ((bytes + 3) / 4) + 2;
-    if (ints < 4) ints = 4;
+void* sbrk(long incr) {
+    long old = brk(0);
+    if (brk((void*) (old + incr)) != old + incr) return (void*) -1;
+    return (void*) old;
+}
 
-    int p = avail;
-    sanity(p);
+static void* doMalloc(long bytes) {
+    if (bytes < 0) return 0;
+    unsigned long size = request(bytes);
 
-    void* res = 0;
-    while ((p != 0) && (res == 0)) {
-        if (!isAvail(p)) {
-            //Debug::panic("block @ %d is not available\n",p);
-        }
-        int sz = size(p);
-        if (sz >= ints) {
-            remove(p);
-            int extra = sz - ints;
-            if (extra >= 4) {
-                makeTaken(p,ints);
-                //Debug::printf("idx = %d, sz = %d, ptr = %p\n",p,ints,&array[p+1]);
-                makeAvail(p+ints,extra);
-            } else {
-                makeTaken(p,sz);
-                //Debug::printf("idx = %d, sz = %d, ptr = %p\n",p,sz,&array[p+1]);
-            }
-            res = &array[p+1];
-        } else {
-            p = next1(p);
-        }
-    }
-    if (res == 0) {
-        //Debug::panic("heap is full, bytes=0x%x",bytes);
+    chunk* c = find(size);
+    if (c == 0) {
+        c = grow(size);
+        if (c == 0) return 0;
     }
-    return res;
+    split(c,size);
+    return payload(c);
 }
 
-void free(void* p) {
+static void doFree(void* p) {
     if (p == 0) return;
-    if (p == (void*) array) return;
-
-    int idx = ((((long) p) - ((long) array)) / 4) - 1;
-    sanity(idx);
-    if (!isTaken(idx)) {
-        //Debug::panic("freeing free block %p %d\n",p,idx);
-        return;
-    }
-
-    int sz = size(idx);
-
-    int leftIndex = left(idx);
-    int rightIndex = right(idx);
-
-    if (isAvail(leftIndex)) {
-        remove(leftIndex);
-        idx = leftIndex;
-        sz += size(leftIndex);
-    }
-
-    if (isAvail(rightIndex)) {
-        remove(rightIndex);
-        sz += size(rightIndex);
+    chunk* c = chunkOf(p);
+    if (!isUsed(c)) return;
+
+    setChunk(c,chunkSize(c),0);
+    c = coalesce(c);
+    insert(c);
+    if ((rightOf(c) == (chunk*) top) && (chunkSize(c) >= TRIM)) {
+        trim(c);
     }
-
-    makeAvail(idx,sz);
 }
 
-void* realloc(void* p, long newSize) {
+static void* doRealloc(void* p, long newSize) {
     if (p == 0) {
-        return malloc(newSize);
+        return doMalloc(newSize);
     }
     if (newSize == 0) {
-        free(p);
+        doFree(p);
         return 0;
     }
-    int idx = ((((long) p) - ((long) array)) / 4) - 1;
-    sanity(idx);
-    if (!isTaken(idx)) {
-        //Debug::panic("freeing free block %p %d\n",p,idx);
-        return 0;
+    chunk* c = chunkOf(p);
+    if (!isUsed(c)) return 0;
+
+    unsigned long size = request(newSize);
+    unsigned long have = chunkSize(c);
+
+    /* shrinking, or growing into a free neighbor */
+    chunk* r = rightOf(c);
+    if ((have < size) && !isUsed(r) && (have + chunkSize(r) >= size)) {
+        unlink(r);
+        have += chunkSize(r);
+        setChunk(c,have,USED);
+    }
+    /* growing at the top of the heap */
+    if ((have < size) && (rightOf(c) == (chunk*) top)) {
+        chunk* more = grow(size - have);
+        if (more == 0) return 0;
+        /* grow merged it with nothing, c is used */
+        have += chunkSize(more);
+        setChunk(c,have,USED);
+    }
+    if (have >= size) {
+        unsigned long extra = have - size;
+        if (extra >= MIN_CHUNK) {
+            setChunk(c,size,USED);
+            chunk* rest = rightOf(c);
+            setChunk(rest,extra,0);
+            insert(coalesce(rest));
+        }
+        return p;
     }
 
-    long sz = size(idx) * 4;
-
-    void* newPtr = malloc(newSize);
+    void* newPtr = doMalloc(newSize);
     if (newPtr) {
-        long m = (newSize > sz) ? sz : newSize;
-        memcpy(newPtr,p,m);
+        memcpy(newPtr,p,have - 8);
+        doFree(p);
     }
-
-    free(p);
     return newPtr;
 }
+
+void* malloc(long bytes) {
+    mutex_lock(&lock);
+    void* p = doMalloc(bytes);
+    mutex_unlock(&lock);
+    return p;
+}
+
+void free(void* p) {
+    mutex_lock(&lock);
+    doFree(p);
+    mutex_unlock(&lock);
+}
+
+void* realloc(void* p, long newSize) {
+    mutex_lock(&lock);
+    void* out = doRealloc(p,newSize);
+    mutex_unlock(&lock);
+    return out;
+}
@@ -4,30 +4,45 @@
 static char hexDigits[] = { '0', '1', '2', '3', '4', '5', '6', '7',
                             '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
 
+long strlen(char* p) {
+    long n = 0;
+    while (p[n] != 0) n++;
+    return n;
+}
+
+long putchar(int c) {
+    char ch = c;
+    return write(STDOUT,&ch,1);
+}
+
 void puts(char* p) {
-    char c;
-    while ((c = *p++) != 0) putchar(c);
+    write(STDOUT,p,strlen(p));
 }
 
+/* the console assembles the line for us, one read is usually enough */
 char* gets() {
-    long sz = 0;
-    char *p = 0;
+    long sz = 80;
     long i = 0;
+    char *p = malloc(sz);
+    if (p == 0) return 0;
 
     while (1) {
-        if (i >= sz) {
-            sz += 10;
-            p = realloc(p,sz+1);
+        if (sz - i < 2) {
+            sz *= 2;
+            p = realloc(p,sz);
             if (p == 0) return 0;
         }
-        char c = getchar();
-        putchar(c);
-        if (c == 13) {
-            puts("\n");
+        long n = read(STDIN,&p[i],sz - i - 1);
+        if (n <= 0) {
+            /* end of file */
             p[i] = 0;
             return p;
         }
-        p[i++] = c;
+        i += n;
+        if (p[i-1] == '\n') {
+            p[i-1] = 0;
+            return p;
+        }
     }
 }
 
@@ -3,17 +3,26 @@
 
 #include "sys.h"
 #include "signal.h"
+#include "sync.h"
+#include "thread.h"
 
+extern long putchar(int c);
 extern void puts(char *p);
 extern char* gets();
 extern void* malloc(long size);
 extern void free(void*);
 extern void* realloc(void* ptr, long newSize);
+/* move the break by incr, returns the old one or (void*) -1 */
+extern void* sbrk(long incr);
 extern void putdec(unsigned long v);
 extern void puthex(long v);
 extern long readFully(long fd, void* buf, long length);
 
 void memset(void* p, int val, long sz);
 void memcpy(void* dest, void* src, long n);
+long strlen(char* p);
+
+/* cycle counter */
+unsigned long long rdtsc();
 
 #endif
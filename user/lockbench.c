@@ -0,0 +1,149 @@
+#include "libc.h"
+
+/*
+ * Lock benchmark: user-space futex locks vs. the semaphore syscalls.
+ *
+ * Reports the average number of cycles per lock/unlock pair.
+ */
+
+#define N 10000
+#define THREADS 4
+
+mutex_t mutex;
+sem_t sem;
+long syscallSem;
+volatile long counter;
+
+void report(char* what, unsigned long long start, unsigned long long end, long n) {
+    unsigned long cycles = (unsigned long) (end - start);
+    puts(what);
+    puts(": ");
+    putdec(cycles / n);
+    puts(" cycles/op\n");
+}
+
+void uncontended() {
+    unsigned long long t0, t1;
+
+    long s = semaphore(1);
+    t0 = rdtsc();
+    for (long i=0; i<N; i++) {
+        down(s);
+        up(s);
+    }
+    t1 = rdtsc();
+    report("syscall semaphore, uncontended",t0,t1,N);
+    close(s);
+
+    mutex_init(&mutex);
+    t0 = rdtsc();
+    for (long i=0; i<N; i++) {
+        mutex_lock(&mutex);
+        mutex_unlock(&mutex);
+    }
+    t1 = rdtsc();
+    report("futex mutex, uncontended",t0,t1,N);
+
+    sem_init(&sem,1);
+    t0 = rdtsc();
+    for (long i=0; i<N; i++) {
+        sem_down(&sem);
+        sem_up(&sem);
+    }
+    t1 = rdtsc();
+    report("futex semaphore, uncontended",t0,t1,N);
+}
+
+void contended() {
+    unsigned long long t0, t1;
+
+    /* two processes hammering the same syscall semaphore */
+    long s = semaphore(1);
+    t0 = rdtsc();
+    long id = fork();
+    for (long i=0; i<N; i++) {
+        down(s);
+        up(s);
+    }
+    if (id == 0) exit(0);
+    join(id);
+    t1 = rdtsc();
+    report("syscall semaphore, 2 processes",t0,t1,2*N);
+    close(s);
+
+    /* the kernel side of a contended futex: a wait that finds the
+       value changed and a wake with nobody to wake */
+    volatile long word = 1;
+    t0 = rdtsc();
+    for (long i=0; i<N; i++) {
+        futex_wait((long*)&word,0);
+        futex_wake((long*)&word,1);
+    }
+    t1 = rdtsc();
+    report("futex wait+wake syscalls",t0,t1,N);
+}
+
+long mutexWorker(void* arg) {
+    for (long i=0; i<N; i++) {
+        mutex_lock(&mutex);
+        counter++;
+        mutex_unlock(&mutex);
+    }
+    return 0;
+}
+
+long semWorker(void* arg) {
+    for (long i=0; i<N; i++) {
+        sem_down(&sem);
+        counter++;
+        sem_up(&sem);
+    }
+    return 0;
+}
+
+long syscallWorker(void* arg) {
+    for (long i=0; i<N; i++) {
+        down(syscallSem);
+        counter++;
+        up(syscallSem);
+    }
+    return 0;
+}
+
+/* THREADS threads incrementing a shared counter under the lock */
+void threads(char* what, long (*worker)(void*)) {
+    thread_t t[THREADS];
+    counter = 0;
+
+    unsigned long long t0 = rdtsc();
+    for (long i=0; i<THREADS; i++) {
+        thread_create(&t[i],worker,0);
+    }
+    for (long i=0; i<THREADS; i++) {
+        thread_join(&t[i]);
+    }
+    unsigned long long t1 = rdtsc();
+
+    report(what,t0,t1,THREADS*N);
+    if (counter != THREADS*N) {
+        puts("*** lost updates: ");
+        putdec(counter);
+        puts("\n");
+    }
+}
+
+int main() {
+    uncontended();
+    contended();
+
+    syscallSem = semaphore(1);
+    threads("syscall semaphore, 4 threads",syscallWorker);
+    close(syscallSem);
+
+    mutex_init(&mutex);
+    threads("futex mutex, 4 threads",mutexWorker);
+
+    sem_init(&sem,1);
+    threads("futex semaphore, 4 threads",semWorker);
+    return 0;
+}
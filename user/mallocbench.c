@@ -0,0 +1,88 @@
+#include "libc.h"
+
+/*
+ * Malloc benchmark.
+ *
+ * Keeps a window of live blocks of mixed sizes, replacing a random one
+ * on every step, then grows a buffer with realloc the way gets does.
+ * Reports cycles per operation and how far the break moved, so memory
+ * that went back to the kernel shows up too.
+ */
+
+#define SLOTS 256
+#define N 20000
+
+static unsigned long seed = 1;
+
+static unsigned long random() {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7fff;
+}
+
+/* mostly small, sometimes big */
+static long pickSize() {
+    unsigned long r = random();
+    if ((r & 15) == 0) return 1024 + (r & 0x3fff);
+    return 8 + (r & 0xff);
+}
+
+void report(char* what, unsigned long long start, unsigned long long end, long n) {
+    unsigned long cycles = (unsigned long) (end - start);
+    puts(what);
+    puts(": ");
+    putdec(cycles / n);
+    puts(" cycles/op\n");
+}
+
+void showBreak(char* what, long base) {
+    puts(what);
+    puts(": ");
+    putdec((brk(0) - base) / 1024);
+    puts("KB above the start of the heap\n");
+}
+
+int main() {
+    static char* live[SLOTS];
+    long base = brk(0);
+    unsigned long long t0, t1;
+
+    t0 = rdtsc();
+    for (long i=0; i<SLOTS; i++) {
+        live[i] = (char*) malloc(pickSize());
+    }
+    for (long i=0; i<N; i++) {
+        long k = random() % SLOTS;
+        free(live[k]);
+        live[k] = (char*) malloc(pickSize());
+        live[k][0] = 1;
+    }
+    t1 = rdtsc();
+    report("malloc/free, mixed sizes",t0,t1,N);
+    showBreak("with the window live",base);
+
+    for (long i=0; i<SLOTS; i++) {
+        free(live[i]);
+    }
+    showBreak("after freeing it",base);
+
+    long bad = 0;
+    t0 = rdtsc();
+    char* buf = 0;
+    long len = 0;
+    for (long i=0; i<N; i++) {
+        if ((i % 64) == 0) {
+            buf = (char*) realloc(buf,len + 64);
+        }
+        buf[len++] = (char) i;
+    }
+    t1 = rdtsc();
+    report("realloc growth",t0,t1,N / 64);
+    for (long i=0; i<len; i++) {
+        if (buf[i] != (char) i) bad = 1;
+    }
+    free(buf);
+    showBreak("after freeing the buffer",base);
+
+    puts(bad ? "realloc lost data\n" : "ok\n");
+    return bad;
+}
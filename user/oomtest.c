@@ -0,0 +1,94 @@
+#include "libc.h"
+
+/*
+ * Memory limit test: children allocate past a memory limit and have to
+ * die of SIGKILL, and memstat's counters have to follow.
+ *
+ * The first child lowers its own limit and checks it can't lift it
+ * again, the second is limited by its parent while it waits on a pipe,
+ * and the third is killed while it's blocked to check SIGKILL gets it
+ * out of the wait.
+ */
+
+#define LIMIT 64            /* frames */
+#define PAGES (4 * LIMIT)
+#define SOME 16             /* pages the second child touches first */
+
+long failures = 0;
+
+void check(char* what, long ok) {
+    puts(what);
+    puts(ok ? ": ok\n" : ": FAILED\n");
+    if (!ok) failures ++;
+}
+
+/* touch n pages of fresh memory */
+void touch(long n) {
+    char* p = (char*) mmap(0,n * 4096,PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS,0,0);
+    if ((long) p < 0) exit(1);
+    for (long i=0; i<n; i++) p[i * 4096] = 1;
+}
+
+/* allocate past the limit, never returns */
+void hog() {
+    touch(PAGES);
+    /* still here, the limit didn't hold */
+    exit(2);
+}
+
+int main() {
+    memstats before;
+    memstats stats;
+    memstat(0,&before);
+    long mine = memlimit(0,MEM_RESIDENT,-1);
+
+    /* its own limit */
+    long child = fork();
+    if (child == 0) {
+        if (memlimit(0,MEM_RESIDENT,LIMIT) < 0) exit(3);
+        if (memlimit(0,MEM_RESIDENT,0) >= 0) exit(4);
+        if (memlimit(0,MEM_RESIDENT,2 * LIMIT) >= 0) exit(5);
+        hog();
+    }
+    check("killed over its own limit",join(child) == SIGKILL);
+
+    /* a limit set by the parent */
+    long down[2];
+    long up[2];
+    pipe(down);
+    pipe(up);
+    child = fork();
+    if (child == 0) {
+        char c = 0;
+        touch(SOME);
+        write(up[1],&c,1);
+        read(down[0],&c,1);
+        hog();
+    }
+    char c = 0;
+    readFully(up[0],&c,1);
+    long pid = pidof(child);
+    memstat(pid,&stats);
+    check("child's pages counted",stats.resident >= SOME);
+    check("limit set on a child",memlimit(pid,MEM_RESIDENT,LIMIT) >= 0);
+    check("child's limit can't go up",memlimit(pid,MEM_RESIDENT,0) < 0);
+    write(down[1],&c,1);
+    check("killed over its parent's limit",join(child) == SIGKILL);
+
+    /* blocked when it's killed */
+    child = fork();
+    if (child == 0) {
+        read(down[0],&c,1);
+        exit(6);
+    }
+    kill(child,SIGKILL);
+    check("killed while blocked",join(child) == SIGKILL);
+
+    memstat(0,&stats);
+    check("limit kills counted",stats.oomKills == before.oomKills + 2);
+    check("our own limit untouched",memlimit(0,MEM_RESIDENT,-1) == mine);
+
+    puts(failures ? "oomtest failed\n" : "oomtest passed\n");
+    return failures;
+}
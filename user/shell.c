@@ -1,6 +1,6 @@
 #include "libc.h"
 
-char** split(char *str) {
+char** split(char *str, char sep) {
     long nWords = 0;
     long nArgs = 0;
     char **args = 0;
@@ -12,7 +12,7 @@ char** split(char *str) {
         char c = str[i];
         if (c == 0) break;
 
-        if (c == ' ') {
+        if (c == sep) {
             str[i] = 0;
             space = 1;
         } else {
@@ -43,15 +43,78 @@ void notFound(char* cmd) {
     puts(": command not found\n");
 }
 
+/* run args in a child with the given standard input and output */
+long launch(char** args, long in, long out) {
+    long id = spawn(args[0],args,in,out);
+    if (id < 0) {
+        notFound(args[0]);
+    }
+    return id;
+}
+
+/* run "a | b | c", each stage reads the output of the one before it */
+void pipeline(char** stages) {
+    long n = 0;
+    while (stages[n] != 0) n++;
+
+    long* ids = (long*) malloc(n * 4);
+    if (ids == 0) return;
+
+    long started = 0;
+    long in = STDIN;
+    for (long i=0; i<n; i++) {
+        char** args = split(stages[i],' ');
+        if ((args == 0) || (args[0] == 0)) {
+            puts("invalid null command\n");
+            if (args) free(args);
+            break;
+        }
+
+        long fds[2];
+        long out = STDOUT;
+        if (i < n - 1) {
+            if (pipe(fds) < 0) {
+                puts("pipe failed\n");
+                free(args);
+                break;
+            }
+            out = fds[1];
+        }
+
+        ids[started++] = launch(args,in,out);
+        free(args);
+
+        /* the child has its own copies now */
+        if (in != STDIN) close(in);
+        if (out != STDOUT) close(out);
+        in = (i < n - 1) ? fds[0] : STDIN;
+    }
+    if (in != STDIN) close(in);
+
+    for (long i=0; i<started; i++) {
+        join(ids[i]);
+    }
+    free(ids);
+}
+
 int main() {
     while (1) {
         puts("shell> ");
         char* in = gets();
         char **args = 0;
+        char **stages = 0;
 
         if (in == 0) goto done;
 
-        args = split(in);
+        stages = split(in,'|');
+        if (stages == 0) goto done;
+        if (stages[0] == 0) goto done;
+        if (stages[1] != 0) {
+            pipeline(stages);
+            goto done;
+        }
+
+        args = split(stages[0],' ');
         if (args == 0) goto done;
         
         char *cmd = args[0];
@@ -69,16 +132,7 @@ int main() {
         if (magic == 0x464c457f) {
             /* executable file */
             close(fd);
-
-            long id = fork();
-            if (id == 0) {
-                /* child */
-                long rc = execv(cmd,args);
-                notFound(cmd);
-                exit(rc);
-            } else {
-                join(id);
-            }
+            join(launch(args,STDIN,STDOUT));
         } else {
             /* write it */
             seek(fd,0);
@@ -90,14 +144,13 @@ int main() {
                     notFound(cmd);
                     break;
                 }
-                for (int j=0; j<n; j++) {
-                    putchar(buf[j]);
-                }
+                write(STDOUT,buf,n);
             }
             close(fd);
         }
 done:
         if (in) free(in);
+        if (stages) free(stages);
         if (args) free(args);
     }
     return 0;
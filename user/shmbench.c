@@ -0,0 +1,115 @@
+#include "libc.h"
+
+/*
+ * Shared memory benchmark: a producer process hands blocks to a
+ * consumer, first through a pipe and then through a ring of slots in a
+ * shared memory segment, synchronized with futex semaphores that live
+ * in the segment too.
+ *
+ * The pipe copies every byte into the kernel and back out; the ring
+ * copies nothing. Reports cycles per block and checks the data.
+ */
+
+#define BLOCK 1024
+#define BLOCKS 4096
+#define SLOTS 16
+
+typedef struct {
+    sem_t empty;
+    sem_t full;
+    char slot[SLOTS][BLOCK];
+} ring;
+
+void fill(char* p, long n) {
+    for (long i=0; i<BLOCK; i++) p[i] = (char) (n + i);
+}
+
+/* 0 if the block came through intact */
+long check(char* p, long n) {
+    for (long i=0; i<BLOCK; i++) {
+        if (p[i] != (char) (n + i)) return 1;
+    }
+    return 0;
+}
+
+void report(char* what, unsigned long long start, unsigned long long end, long bad) {
+    unsigned long cycles = (unsigned long) (end - start);
+    puts(what);
+    puts(": ");
+    putdec(cycles / BLOCKS);
+    puts(" cycles/block");
+    puts(bad ? ", data lost\n" : "\n");
+}
+
+void viaPipe() {
+    static char buf[BLOCK];
+    long fds[2];
+    if (pipe(fds) < 0) {
+        puts("pipe failed\n");
+        return;
+    }
+
+    unsigned long long t0 = rdtsc();
+    long id = fork();
+    if (id == 0) {
+        close(fds[0]);
+        for (long n=0; n<BLOCKS; n++) {
+            fill(buf,n);
+            write(fds[1],buf,BLOCK);
+        }
+        exit(0);
+    }
+    close(fds[1]);
+    long bad = 0;
+    for (long n=0; n<BLOCKS; n++) {
+        if (readFully(fds[0],buf,BLOCK) != BLOCK) bad = 1;
+        bad |= check(buf,n);
+    }
+    join(id);
+    unsigned long long t1 = rdtsc();
+    close(fds[0]);
+    report("pipe",t0,t1,bad);
+}
+
+void viaShm() {
+    long seg = shm(sizeof(ring));
+    if (seg < 0) {
+        puts("shm failed\n");
+        return;
+    }
+    ring* r = (ring*) mmap(0,sizeof(ring),PROT_READ | PROT_WRITE,MAP_SHARED,seg,0);
+    if ((long) r < 0) {
+        puts("mmap failed\n");
+        return;
+    }
+    sem_init(&r->empty,SLOTS);
+    sem_init(&r->full,0);
+
+    unsigned long long t0 = rdtsc();
+    long id = fork();
+    if (id == 0) {
+        for (long n=0; n<BLOCKS; n++) {
+            sem_down(&r->empty);
+            fill(r->slot[n % SLOTS],n);
+            sem_up(&r->full);
+        }
+        exit(0);
+    }
+    long bad = 0;
+    for (long n=0; n<BLOCKS; n++) {
+        sem_down(&r->full);
+        bad |= check(r->slot[n % SLOTS],n);
+        sem_up(&r->empty);
+    }
+    join(id);
+    unsigned long long t1 = rdtsc();
+    munmap(r,sizeof(ring));
+    close(seg);
+    report("shared memory",t0,t1,bad);
+}
+
+int main() {
+    viaPipe();
+    viaShm();
+    return 0;
+}
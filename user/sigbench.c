@@ -0,0 +1,150 @@
+#include "libc.h"
+
+/*
+ * Signal latency benchmark.
+ *
+ * The parent sends SIGRTMIN to a forked child, the child's handler
+ * reads the cycle counter, and the child writes that time back through
+ * a pipe. The difference from the parent's time just before kill is
+ * the send-to-handler latency. Reports a histogram, then a short run
+ * with the kernel tracepoints on to show where the time goes.
+ */
+
+#define N 1000
+#define TRACED 32
+#define BUCKETS 24
+
+volatile long ready = 0;
+volatile unsigned long handled;
+
+void pingHandler(regs *context) {
+    handled = (unsigned long) rdtsc();
+    ready = 1;
+}
+
+/* the child answers n pings, then exits */
+void pong(long out, long n) {
+    signal(SIGRTMIN, (void*)&pingHandler);
+    /* tell the parent the handler is in place */
+    unsigned long t = 0;
+    write(out, &t, sizeof(t));
+
+    for (long i=0; i<n; i++) {
+        while (!ready);
+        ready = 0;
+        t = handled;
+        write(out, &t, sizeof(t));
+    }
+    exit(0);
+}
+
+/* n round trips with a fresh child, fills in latencies (cycles) */
+void pingpong(unsigned long* lat, long n) {
+    long fds[2];
+    pipe(fds);
+    long child = fork();
+    if (child == 0) {
+        close(fds[0]);
+        pong(fds[1], n);
+    }
+    close(fds[1]);
+
+    unsigned long t;
+    readFully(fds[0], &t, sizeof(t));
+    for (long i=0; i<n; i++) {
+        unsigned long t0 = (unsigned long) rdtsc();
+        kill(child, SIGRTMIN);
+        readFully(fds[0], &t, sizeof(t));
+        lat[i] = t - t0;
+    }
+    join(child);
+    close(fds[0]);
+}
+
+/* bucket b holds latencies in [2^b, 2^(b+1)) */
+void histogram(unsigned long* lat, long n) {
+    long counts[BUCKETS];
+    unsigned long min = lat[0], max = lat[0], sum = 0;
+
+    for (long b=0; b<BUCKETS; b++) counts[b] = 0;
+    for (long i=0; i<n; i++) {
+        unsigned long v = lat[i];
+        long b = 0;
+        while ((b < BUCKETS - 1) && (v >= (2ul << b))) b++;
+        counts[b]++;
+        if (v < min) min = v;
+        if (v > max) max = v;
+        sum += v / n;
+    }
+
+    puts("kill to handler, cycles: min ");
+    putdec(min);
+    puts(" avg ");
+    putdec(sum);
+    puts(" max ");
+    putdec(max);
+    puts("\n");
+    for (long b=0; b<BUCKETS; b++) {
+        if (counts[b] == 0) continue;
+        puts("  >= ");
+        putdec(1ul << b);
+        puts(": ");
+        putdec(counts[b]);
+        puts("\n");
+    }
+}
+
+/* average time between consecutive tracepoints */
+void breakdown() {
+    traceevent ev[4 * TRACED + 16];
+    unsigned long lat[TRACED];
+    unsigned long sums[4] = { 0, 0, 0, 0 };
+    unsigned long last[4] = { 0, 0, 0, 0 };
+    long seen = 0;
+    long complete = 0;
+
+    trace(1);
+    pingpong(lat, TRACED);
+    trace(0);
+
+    long n = traceread(ev, sizeof(ev) / sizeof(ev[0]));
+    for (long i=0; i<n; i++) {
+        if (ev[i].sig != SIGRTMIN) continue;
+        long e = ev[i].event;
+        if (e == TRACE_SIG_ENQUEUE) {
+            last[0] = ev[i].tsc;
+            seen = 1;
+        } else if ((e == seen + 1) && (e <= TRACE_SIG_RETURN)) {
+            /* only the first dispatch after the send counts */
+            last[e - 1] = ev[i].tsc;
+            sums[e - 1] += last[e - 1] - last[e - 2];
+            seen = e;
+            if (e == TRACE_SIG_RETURN) complete++;
+        }
+    }
+
+    if (complete == 0) {
+        puts("no complete traces\n");
+        return;
+    }
+    puts("traced ");
+    putdec(complete);
+    puts(" signals, average cycles:\n");
+    puts("  send to dispatch: ");
+    putdec(sums[1] / complete);
+    puts("\n  dispatch to frame: ");
+    putdec(sums[2] / complete);
+    puts("\n  frame to sigret: ");
+    putdec(sums[3] / complete);
+    puts("\n");
+}
+
+int main() {
+    unsigned long* lat = (unsigned long*) malloc(N * sizeof(unsigned long));
+    pingpong(lat, N);
+    histogram(lat, N);
+    free(lat);
+
+    breakdown();
+    return 0;
+}
@@ -8,6 +8,15 @@
 #define SIGCHLD (17)
 #define SIGKILL (9)
 
+// Real-time signals are counted, each kill is delivered once
+#define SIGRTMIN (24)
+#define SIGRTMAX (31)
+
+// sigprocmask, the mask has bit (1 << sig) set for each blocked signal
+#define SIG_BLOCK (0)
+#define SIG_UNBLOCK (1)
+#define SIG_SETMASK (2)
+
 // Dispositions
 #define SIG_IGN (0)
 #define SIG_DFL (1)
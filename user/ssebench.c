@@ -0,0 +1,96 @@
+#include "libc.h"
+
+/*
+ * SSE benchmark: several processes keep live values in the xmm
+ * registers while the timer switches between them.
+ *
+ * Each process adds its own increment into xmm0 in a tight loop and
+ * checks the exact sum at the end, so a context switch that loses or
+ * mixes up the SSE state shows up as a wrong answer. The same loop on
+ * the integer registers is the baseline; the difference is the cost of
+ * the lazy FPU switching.
+ */
+
+#define ITERS (1 << 20)
+#define ROUNDS 4
+
+/* ITERS times acc += inc, on the xmm registers */
+void sseLoop(long* acc, long* inc) {
+    __asm__ __volatile__(
+        "movdqu (%0),%%xmm0\n"
+        "movdqu (%1),%%xmm1\n"
+        "mov %2,%%ecx\n"
+        "1:\n"
+        "paddd %%xmm1,%%xmm0\n"
+        "dec %%ecx\n"
+        "jnz 1b\n"
+        "movdqu %%xmm0,(%0)\n"
+        :
+        : "r" (acc), "r" (inc), "i" (ITERS)
+        : "ecx", "memory", "cc");
+}
+
+/* the same thing on the integer registers */
+void intLoop(long* acc, long* inc) {
+    long a0 = acc[0], a1 = acc[1], a2 = acc[2], a3 = acc[3];
+    for (long i=0; i<ITERS; i++) {
+        a0 += inc[0]; a1 += inc[1]; a2 += inc[2]; a3 += inc[3];
+        __asm__ __volatile__("" : "+r" (a0), "+r" (a1), "+r" (a2), "+r" (a3));
+    }
+    acc[0] = a0; acc[1] = a1; acc[2] = a2; acc[3] = a3;
+}
+
+/* returns 0 if the sums came out right */
+long work(long id, void (*loop)(long*, long*)) {
+    long acc[4] = { 0, 0, 0, 0 };
+    long inc[4] = { id, id + 1, id + 2, id + 3 };
+
+    for (long r=0; r<ROUNDS; r++) {
+        loop(acc,inc);
+    }
+
+    long bad = 0;
+    for (long j=0; j<4; j++) {
+        if (acc[j] != inc[j] * ITERS * ROUNDS) bad = 1;
+    }
+    return bad;
+}
+
+/* n processes running the loop at the same time */
+void run(char* what, long n, void (*loop)(long*, long*)) {
+    long ids[4];
+    long bad = 0;
+
+    unsigned long long t0 = rdtsc();
+    for (long i=0; i<n; i++) {
+        ids[i] = fork();
+        if (ids[i] == 0) {
+            exit(work(i + 1,loop));
+        }
+    }
+    for (long i=0; i<n; i++) {
+        bad += join(ids[i]);
+    }
+    unsigned long long t1 = rdtsc();
+
+    unsigned long cycles = (unsigned long) (t1 - t0);
+    puts(what);
+    puts(", ");
+    putdec(n);
+    puts(" processes: ");
+    putdec(cycles / (n * ROUNDS));
+    puts(" cycles/round\n");
+    if (bad) {
+        puts("*** wrong sums in ");
+        putdec(bad);
+        puts(" processes\n");
+    }
+}
+
+int main() {
+    for (long n=1; n<=4; n*=2) {
+        run("integer",n,intLoop);
+        run("sse",n,sseLoop);
+    }
+    return 0;
+}
@@ -0,0 +1,57 @@
+#include "libc.h"
+
+/*
+ * The mutex follows "Futexes Are Tricky" (Drepper), mutex #2.
+ */
+
+void mutex_init(mutex_t* m) {
+    m->value = 0;
+}
+
+void mutex_lock(mutex_t* m) {
+    long c = atomic_cas(&m->value,0,1);
+    if (c == 0) return;
+
+    /* contended, say so and sleep until it's ours */
+    if (c != 2) {
+        c = atomic_swap(&m->value,2);
+    }
+    while (c != 0) {
+        futex_wait((long*)&m->value,2);
+        c = atomic_swap(&m->value,2);
+    }
+}
+
+void mutex_unlock(mutex_t* m) {
+    if (atomic_add(&m->value,-1) != 1) {
+        /* somebody might be sleeping */
+        m->value = 0;
+        futex_wake((long*)&m->value,1);
+    }
+}
+
+void sem_init(sem_t* s, long count) {
+    s->count = count;
+    s->waiters = 0;
+}
+
+void sem_down(sem_t* s) {
+    while (1) {
+        long c = s->count;
+        if (c > 0) {
+            if (atomic_cas(&s->count,c,c-1) == c) return;
+        } else {
+            atomic_add(&s->waiters,1);
+            /* returns right away if an up got in first */
+            futex_wait((long*)&s->count,0);
+            atomic_add(&s->waiters,-1);
+        }
+    }
+}
+
+void sem_up(sem_t* s) {
+    atomic_add(&s->count,1);
+    if (s->waiters > 0) {
+        futex_wake((long*)&s->count,1);
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef _SYNC_H_
+#define _SYNC_H_
+
+/*
+ * User-space locks. The uncontended paths are a single atomic
+ * instruction, the kernel is only entered (futex_wait/futex_wake)
+ * when somebody has to sleep or be woken up.
+ */
+
+/* 0 => unlocked, 1 => locked, 2 => locked and maybe contended */
+typedef struct {
+    volatile long value;
+} mutex_t;
+
+typedef struct {
+    volatile long count;
+    volatile long waiters;
+} sem_t;
+
+extern void mutex_init(mutex_t* m);
+extern void mutex_lock(mutex_t* m);
+extern void mutex_unlock(mutex_t* m);
+
+extern void sem_init(sem_t* s, long count);
+extern void sem_down(sem_t* s);
+extern void sem_up(sem_t* s);
+
+/* returns the old value */
+static inline long atomic_add(volatile long* p, long v) {
+    __asm__ __volatile__ ("lock xadd %0,%1"
+        : "+r" (v), "+m" (*p)
+        :
+        : "memory", "cc");
+    return v;
+}
+
+/* returns the old value, the swap happened if it equals expected */
+static inline long atomic_cas(volatile long* p, long expected, long v) {
+    long old;
+    __asm__ __volatile__ ("lock cmpxchg %2,%1"
+        : "=a" (old), "+m" (*p)
+        : "r" (v), "0" (expected)
+        : "memory", "cc");
+    return old;
+}
+
+/* returns the old value */
+static inline long atomic_swap(volatile long* p, long v) {
+    __asm__ __volatile__ ("xchg %0,%1"
+        : "+r" (v), "+m" (*p)
+        :
+        : "memory");
+    return v;
+}
+
+#endif
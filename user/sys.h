@@ -8,7 +8,6 @@ extern long getlen(long);
 extern long close(long);
 extern long read(long f, void* buf, long len);
 extern long seek(long f, long pos);
-extern long putchar(int c);
 extern long getchar();
 extern long semaphore(long n);
 extern long up(long sem);
@@ -20,6 +19,131 @@ extern long kill(long pd, long sig);
 extern long signal(long sig, void *sighandler);
 extern long alarm(long seconds);
 extern long sigreturn();
-extern long mmap(void *adr);
+/* map len bytes at addr (a hint unless MAP_FIXED), returns the
+   address or a negative error. Without MAP_ANONYMOUS it maps the file
+   fd from offset (a multiple of 4096), straight from the page cache;
+   only MAP_PRIVATE file mappings can be written, into private copies */
+extern void* mmap(void *addr, long len, long prot, long flags, long fd, long offset);
+extern long munmap(void* addr, long len);
+extern long mprotect(void* addr, long len, long prot);
+/* a new shared memory segment of bytes, zero filled, returns its
+   descriptor. Children inherit it, map it with MAP_SHARED and fd */
+extern long shm(long bytes);
+extern long ioctl(long fd, long cmd, long arg);
+extern long pipe(long fds[2]);
+extern long write(long fd, void* buf, long len);
+extern long dup2(long fd, long newfd);
+extern long futex_wait(long* adr, long val);
+extern long futex_wake(long* adr, long n);
+/* start a thread at pc with stack pointer esp, returns its descriptor */
+extern long clone(void* pc, void* esp);
+extern long sigprocmask(long how, long mask);
+/* like fork but the child borrows our memory, we don't run again
+   until it calls execv or exit */
+extern long vfork();
+/* run a program in a new process with in and out as its standard
+   input and output, returns its descriptor */
+extern long spawn(char* prog, char** args, long in, long out);
+/* move the end of the heap to adr, returns where it ends up so
+   brk(0) asks where it is. Pages above it go back to the kernel */
+extern long brk(void* adr);
+
+/* process ids */
+extern long getpid();
+/* the id of the process behind a descriptor */
+extern long pidof(long pd);
+/* kill by id rather than descriptor */
+extern long killpid(long pid, long sig);
+/* wait for a child to exit (pid == -1 => any child), returns its id
+   and stores its exit code in *status if status isn't 0 */
+extern long waitpid(long pid, long* status);
+
+/* kernel signal tracepoints */
+typedef struct {
+    unsigned long tsc;          /* low half of the cycle counter */
+    unsigned short event;
+    unsigned short sig;
+    unsigned long pid;
+} traceevent;
+
+#define TRACE_SIG_ENQUEUE (1)   /* sent */
+#define TRACE_SIG_DISPATCH (2)  /* target dispatched with it pending */
+#define TRACE_SIG_FRAME (3)     /* handler frame set up */
+#define TRACE_SIG_RETURN (4)    /* handler returned */
+
+/* turn tracing on or off, returns the old setting */
+extern long trace(long on);
+/* take up to n of the oldest events, returns how many */
+extern long traceread(traceevent* buf, long n);
+
+typedef struct {
+    long fd;
+    long events;        /* what the caller is waiting for */
+    long revents;       /* what is ready, filled in by poll */
+} pollfd;
+
+/* wait until one of the descriptors is ready or timeout ms have passed
+   (timeout < 0 => forever), returns how many are ready */
+extern long poll(pollfd* fds, long n, long timeout);
+
+/* standard descriptors, both start out as the console */
+#define STDIN (0)
+#define STDOUT (1)
+
+/* poll events
+   POLLIN:   semaphore count > 0, child terminated, input available,
+             pipe has data or no writers
+   POLLOUT:  console, or pipe with room or no readers
+   POLLNVAL: not an open descriptor */
+#define POLLIN (1)
+#define POLLOUT (4)
+#define POLLNVAL (32)
+
+/* memory use of a process, and of the machine */
+typedef struct {
+    unsigned long resident;     /* private frames mapped */
+    unsigned long tables;       /* page table frames */
+    unsigned long heap;         /* kernel heap bytes charged to it */
+    unsigned long shm;          /* frames of shm segments it created */
+    unsigned long freeFrames;
+    unsigned long totalFrames;
+    unsigned long oomKills;     /* processes killed for memory so far */
+} memstats;
+
+/* fill in buf for process pid, 0 for the caller */
+extern long memstat(long pid, memstats* buf);
+/* lower one of the limits (0 => none) of process pid, 0 for the
+   caller, which has to be the caller or one of its children; value < 0
+   only looks. Limits never go back up. Returns the old one; children
+   and threads inherit them, and a process over one is killed */
+extern long memlimit(long pid, long which, long value);
+
+#define MEM_RESIDENT (0)    /* frames */
+#define MEM_TABLES (1)      /* frames */
+#define MEM_HEAP (2)        /* bytes */
+
+/* mmap protection, PROT_NONE keeps the memory but faults on access */
+#define PROT_NONE (0)
+#define PROT_READ (1)
+#define PROT_WRITE (2)
+#define PROT_EXEC (4)
+
+/* mmap flags */
+#define MAP_SHARED (1)
+#define MAP_PRIVATE (2)
+#define MAP_FIXED (0x10)
+#define MAP_ANONYMOUS (0x20)
+/* private anonymous memory in 4MB pages where the area covers them,
+   the length rounds up to 4MB */
+#define MAP_HUGETLB (0x40000)
+
+/* console ioctl commands */
+#define TTY_GET_MODE (1)
+#define TTY_SET_MODE (2)
+
+/* console modes, the kernel does line editing and echo in cooked mode */
+#define TTY_RAW (0)
+#define TTY_COOKED (1)
+#define TTY_ECHO (2)
 
 #endif
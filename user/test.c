@@ -38,7 +38,8 @@ void sigchldHandler(regs *context) {
 }
 
 void handleSegfault(regs *context) {
-    mmap((void*)context->cr2);
+    mmap((void*)(context->cr2 & ~0xfff),4096,PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,-1,0);
 }
 
 int main(){
@@ -78,8 +79,8 @@ int main(){
     if(fk == 0){
         signal(SIGSEGV, &handleSegfault);
         int value = 0xCAFE;
-        *(int*)0x500000 = value; // segv
-        exit(*(int*)0x500000);
+        *(int*)0x40000000 = value; // segv
+        exit(*(int*)0x40000000);
     } else {
         // wait for child to die
         long ret = join(fk);
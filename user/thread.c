@@ -0,0 +1,31 @@
+#include "libc.h"
+
+#define STACK_BYTES (16 * 1024)
+
+extern void thread_entry();
+
+long thread_create(thread_t* t, long (*func)(void*), void* arg) {
+    long* stack = (long*) malloc(STACK_BYTES);
+    if (stack == 0) return -1;
+
+    /* thread_entry pops func and calls it with arg */
+    long* sp = &stack[STACK_BYTES / sizeof(long)];
+    *--sp = (long) arg;
+    *--sp = (long) func;
+
+    long id = clone(thread_entry,sp);
+    if (id < 0) {
+        free(stack);
+        return id;
+    }
+    t->id = id;
+    t->stack = stack;
+    return 0;
+}
+
+long thread_join(thread_t* t) {
+    long rc = join(t->id);
+    free(t->stack);
+    t->stack = 0;
+    return rc;
+}
@@ -0,0 +1,22 @@
+#ifndef _THREAD_H_
+#define _THREAD_H_
+
+/*
+ * Threads share the address space and the descriptors of the process
+ * that created them. Each one has its own stack and signal mask.
+ *
+ * exit() only ends the calling thread.
+ */
+
+typedef struct {
+    long id;            /* descriptor, as returned by clone */
+    void* stack;
+} thread_t;
+
+/* run func(arg) in a new thread, returns < 0 on failure */
+extern long thread_create(thread_t* t, long (*func)(void*), void* arg);
+
+/* wait for the thread to finish, returns what func returned */
+extern long thread_join(thread_t* t);
+
+#endif
@@ -0,0 +1,56 @@
+#include "libc.h"
+
+/*
+ * TLB benchmark: touches one word in pages picked at random from a
+ * 32MB anonymous area, far more pages than the TLB holds, first with
+ * 4K pages and then with MAP_HUGETLB so 8 large pages cover it all.
+ *
+ * Reports the cycles to fault the area in and the cycles per access
+ * once it is in, and checks the data.
+ */
+
+#define SIZE (32 * 1024 * 1024)
+#define PAGES (SIZE / 4096)
+#define ACCESSES (1 << 20)
+
+void run(char* what, long flags) {
+    unsigned long long t0 = rdtsc();
+    long* area = (long*) mmap(0,SIZE,PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | flags,0,0);
+    if ((long) area < 0) {
+        puts("mmap failed\n");
+        return;
+    }
+    for (long p=0; p<PAGES; p++) area[p * 1024] = p;
+    unsigned long long t1 = rdtsc();
+
+    unsigned long seed = 1;
+    long bad = 0;
+    for (long n=0; n<ACCESSES; n++) {
+        seed = seed * 1103515245 + 12345;
+        long p = (seed >> 8) % PAGES;
+        /* a different word each time, same page */
+        long* w = &area[p * 1024 + (n & 1023)];
+        if ((n & 1023) == 0) {
+            if (*w != p) bad = 1;
+        } else {
+            *w = n;
+        }
+    }
+    unsigned long long t2 = rdtsc();
+    munmap(area,SIZE);
+
+    puts(what);
+    puts(": ");
+    putdec(((unsigned long) (t1 - t0)) / PAGES);
+    puts(" cycles/page to fault in, ");
+    putdec(((unsigned long) (t2 - t1)) / ACCESSES);
+    puts(" cycles/access");
+    puts(bad ? ", data lost\n" : "\n");
+}
+
+int main() {
+    run("4K pages",0);
+    run("4M pages",MAP_HUGETLB);
+    return 0;
+}